@@ -2,22 +2,30 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
+	nt_bulk_stat.cpp \
 	nt_df.cpp \
 	nt_du.cpp \
 	nt_file_exists.cpp \
 	nt_get_owner.cpp \
+	nt_link_audit.cpp \
 	nt_list_links.cpp \
 	nt_mounter.cpp \
+	nt_move.cpp \
 	nt_read_file.cpp \
 	nt_recursive_chown.cpp \
 	nt_recursive_cp.cpp \
 	nt_recursive_crawl.cpp \
 	nt_recursive_remove.cpp \
+	nt_tar.cpp \
 	\
+	nt_qos.cpp \
+	nt_stats.cpp \
+	nt_trace.cpp \
 	nt_utils.cpp \
+	nt_walk.cpp \
 	nativetools.cpp
 
-LOCAL_C_INCLUDES := external/cfr/lib
+LOCAL_C_INCLUDES := external/cfr/lib external/zlib
 
 LOCAL_CFLAGS := -Os -g -W -Wall \
 	-DHAVE_UNISTD_H \
@@ -46,6 +54,7 @@ LOCAL_CFLAGS := -Os -g -W -Wall \
 LOCAL_MODULE := nativetools
 LOCAL_MODULE_TAGS := eng
 LOCAL_SYSTEM_SHARED_LIBRARIES := libc
+LOCAL_SHARED_LIBRARIES := libz
 
 
 include $(BUILD_EXECUTABLE)
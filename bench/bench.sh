@@ -0,0 +1,108 @@
+#!/bin/bash
+#
+# Benchmarks the tree applets on a synthetic tree, see readme.md.
+#
+# bench.sh [--profile default|wide|deep|large] [--runs N] [--dir D] [--out FILE] [--syscalls] [--gen "nt_gentree options"]
+#
+# Appends one JSON line per run to FILE (default: bench/results/<commit>.jsonl).
+# Compare two result files with bench/compare.sh.
+
+PROGDIR=`dirname $0`
+PROGDIR=`cd $PROGDIR && pwd`
+NT=$PROGDIR/../nativetools
+GENTREE=$PROGDIR/nt_gentree
+BENCH=$PROGDIR/nt_bench
+
+PROFILE=default
+RUNS=3
+DIR=/tmp/nt-bench
+OUT=
+SYSCALLS=
+GEN=
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --profile)  PROFILE=$2; shift ;;
+        --runs)     RUNS=$2; shift ;;
+        --dir)      DIR=$2; shift ;;
+        --out)      OUT=$2; shift ;;
+        --syscalls) SYSCALLS=--syscalls ;;
+        --gen)      GEN=$2; shift ;;
+        *)          echo "Unknown option $1" >&2; exit 1 ;;
+    esac
+    shift
+done
+
+case "$PROFILE" in
+    default) PROFILE_ARGS="--depth 4 --fanout 4 --files 16" ;;
+    wide)    PROFILE_ARGS="--depth 1 --fanout 2 --files 5000 --max-size 4096" ;;
+    deep)    PROFILE_ARGS="--depth 64 --fanout 1 --files 4" ;;
+    large)   PROFILE_ARGS="--depth 2 --fanout 3 --files 8 --min-size 65536 --max-size 8388608" ;;
+    *)       echo "Unknown profile $PROFILE" >&2; exit 1 ;;
+esac
+
+for tool in $NT $GENTREE $BENCH; do
+    if [ ! -x $tool ]; then
+        echo "$tool is missing, run make bench" >&2
+        exit 1
+    fi
+done
+
+COMMIT=`cd $PROGDIR && git rev-parse --short HEAD 2>/dev/null || echo unknown`
+if [ -z "$OUT" ]; then
+    mkdir -p $PROGDIR/results
+    OUT=$PROGDIR/results/$COMMIT.jsonl
+fi
+
+# The tree is only regenerated when its parameters change
+TREE=$DIR/tree
+STAMP="$PROFILE_ARGS $GEN"
+if [ ! -d $TREE ] || [ "`cat $DIR/stamp 2>/dev/null`" != "$STAMP" ]; then
+    rm -rf $DIR
+    mkdir -p $DIR
+    echo "Generating $PROFILE tree in $TREE" >&2
+    $GENTREE $PROFILE_ARGS $GEN $TREE >&2 || exit 1
+    echo "$STAMP" > $DIR/stamp
+fi
+
+OWNER=`id -u`
+if [ "$OWNER" = "0" ]; then
+    OWNER=1000
+fi
+
+# Puts the scratch area back in shape before each run, untimed
+setup_for() {
+    case "$1" in
+        cp) echo "rm -rf $DIR/dest && mkdir -p $DIR/dest" ;;
+        rm) echo "rm -rf $DIR/victim && cp -a $TREE $DIR/victim" ;;
+        *)  echo "true" ;;
+    esac
+}
+
+command_for() {
+    case "$1" in
+        cr) echo "$NT cr $TREE" ;;
+        du) echo "$NT du $TREE" ;;
+        cp) echo "$NT cp $TREE $DIR/dest" ;;
+        rm) echo "$NT rm $DIR/victim" ;;
+        co) echo "$NT co $TREE 99 $OWNER" ;;
+    esac
+}
+
+record() {
+    sed "s/^{/{\"commit\":\"$COMMIT\",\"profile\":\"$PROFILE\",\"run\":$1,/" >> $OUT
+}
+
+for case in cr du cp rm co; do
+    SETUP=`setup_for $case`
+    for run in `seq 1 $RUNS`; do
+        # Cold: caches are dropped when we are allowed to (root)
+        $BENCH --label $case --setup "$SETUP" --cold -- `command_for $case` | record $run
+        # Warm: one unmeasured run first
+        sh -c "$SETUP" && `command_for $case` > /dev/null 2>&1
+        $BENCH --label $case --setup "$SETUP" $SYSCALLS -- `command_for $case` | record $run
+    done
+done
+rm -rf $DIR/dest $DIR/victim
+
+echo "Results appended to $OUT" >&2
@@ -0,0 +1,46 @@
+#!/bin/bash
+#
+# compare.sh <before.jsonl> <after.jsonl>
+#
+# Median wall time, syscalls and bytes read/written per case and cache state,
+# with the relative change of the wall time.
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <before.jsonl> <after.jsonl>" >&2
+    exit 1
+fi
+
+awk '
+function field(line, key,    m) {
+    if(match(line, "\"" key "\":(\"[^\"]*\"|-?[0-9]+)")) {
+        m = substr(line, RSTART + length(key) + 3, RLENGTH - length(key) - 3)
+        gsub("\"", "", m)
+        return m
+    }
+    return ""
+}
+function median(list,    n, a, i, j, t) {
+    n = split(list, a, " ")
+    for(i = 2; i <= n; i++) for(j = i; j > 1 && a[j-1] + 0 > a[j] + 0; j--) { t = a[j]; a[j] = a[j-1]; a[j-1] = t }
+    return n ? a[int((n + 1) / 2)] : 0
+}
+FNR == 1 {
+    side = files++
+}
+{
+    key = field($0, "profile") "/" field($0, "label") "/" field($0, "cache")
+    keys[key] = 1
+    wall[side, key] = wall[side, key] " " field($0, "wall_us")
+    sc = field($0, "syscalls")
+    if(sc != "-1") sys[side, key] = sys[side, key] " " sc
+    rb[side, key] = rb[side, key] " " field($0, "rchar")
+    wb[side, key] = wb[side, key] " " field($0, "wchar")
+}
+END {
+    printf "%-24s %12s %12s %8s %10s %10s %12s %12s\n", "case", "before_us", "after_us", "change", "sys_bef", "sys_aft", "rchar_aft", "wchar_aft"
+    for(key in keys) {
+        b = median(wall[0, key]); a = median(wall[1, key])
+        printf "%-24s %12d %12d %7.1f%% %10s %10s %12d %12d\n", key, b, a, b ? (a - b) * 100 / b : 0,
+            median(sys[0, key]), median(sys[1, key]), median(rb[1, key]), median(wb[1, key])
+    }
+}' "$1" "$2" | sort
@@ -0,0 +1,219 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+/*
+ * Runs one command and prints what it cost as a single JSON line.
+ *
+ * nt_bench [--label L] [--setup CMD] [--cold] [--syscalls] -- <command> [args...]
+ *   --label L     name of the case, copied to the output
+ *   --setup CMD   shell command run, untimed, before each run of the command
+ *   --cold        sync and drop the page cache first (root only); reported as
+ *                 "cold-unflushed" when it could not be dropped
+ *   --syscalls    also count system calls, during a second, traced run whose
+ *                 timings are not reported
+ *
+ * Bytes and read/write call counts come from /proc/<pid>/io, which is read
+ * while the child is a zombie, right before reaping it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+
+typedef struct {
+    long long rchar, wchar, syscr, syscw, read_bytes, write_bytes;
+} nt_bench_io;
+
+static long long nt_bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int nt_bench_drop_caches() {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if(fd < 0) {
+        return EXIT_FAILURE;
+    }
+    int ret = write(fd, "3\n", 2) == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+    close(fd);
+    return ret;
+}
+
+static void nt_bench_read_io(pid_t pid, nt_bench_io *io) {
+    char path[64], line[128];
+    memset(io, 0, sizeof(nt_bench_io));
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        return;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        long long value;
+        char key[32];
+        if(2 != sscanf(line, "%31[^:]: %lld", key, &value)) continue;
+        if(!strcmp(key, "rchar"))            io->rchar = value;
+        else if(!strcmp(key, "wchar"))       io->wchar = value;
+        else if(!strcmp(key, "syscr"))       io->syscr = value;
+        else if(!strcmp(key, "syscw"))       io->syscw = value;
+        else if(!strcmp(key, "read_bytes"))  io->read_bytes = value;
+        else if(!strcmp(key, "write_bytes")) io->write_bytes = value;
+    }
+    fclose(f);
+}
+
+static pid_t nt_bench_spawn(char **cmd, int traced) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        // The command's own output is not what we are measuring
+        int devnull = open("/dev/null", O_WRONLY);
+        if(devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+        if(traced) {
+            ptrace(PTRACE_TRACEME, 0, 0, 0);
+            raise(SIGSTOP);
+        }
+        execvp(cmd[0], cmd);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Every thread stops twice per system call, except on exit
+static long long nt_bench_count_syscalls(char **cmd) {
+    pid_t pid = nt_bench_spawn(cmd, 1);
+    int status;
+    if(pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    long long stops = 0;
+    pid_t tid;
+    while((tid = waitpid(-1, &status, __WALL)) > 0) {
+        if(WIFEXITED(status) || WIFSIGNALED(status)) {
+            continue;
+        }
+        int sig = 0;
+        if(WIFSTOPPED(status)) {
+            if(WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+                ++ stops;
+            }
+            else if(WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+                sig = WSTOPSIG(status);
+            }
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, sig);
+    }
+    return (stops + 1) / 2;
+}
+
+static void nt_bench_json_string(const char *s) {
+    putchar('"');
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') putchar('\\');
+        if((unsigned char)*s >= 0x20) putchar(*s);
+    }
+    putchar('"');
+}
+
+static int nt_bench_setup(const char *setup) {
+    if(setup && 0 != system(setup)) {
+        fprintf(stderr, "Setup failed: %s\n", setup);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    const char *label = "";
+    const char *setup = 0;
+    int cold = 0, syscalls = 0;
+
+    int i;
+    for(i=1; i<argc && strcmp(argv[i], "--"); i++) {
+        if(!strcmp(argv[i], "--label") && i + 1 < argc) {
+            label = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--setup") && i + 1 < argc) {
+            setup = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--cold")) {
+            cold = 1;
+        }
+        else if(!strcmp(argv[i], "--syscalls")) {
+            syscalls = 1;
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(i + 1 >= argc) {
+        fprintf(stderr, "Usage: %s [--label L] [--setup CMD] [--cold] [--syscalls] -- <command> [args...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char **cmd = &argv[i + 1];
+
+    long long nsyscalls = -1;
+    if(syscalls) {
+        if(EXIT_SUCCESS != nt_bench_setup(setup)) {
+            return EXIT_FAILURE;
+        }
+        nsyscalls = nt_bench_count_syscalls(cmd);
+    }
+
+    if(EXIT_SUCCESS != nt_bench_setup(setup)) {
+        return EXIT_FAILURE;
+    }
+    const char *cache = "warm";
+    if(cold) {
+        cache = EXIT_SUCCESS == nt_bench_drop_caches() ? "cold" : "cold-unflushed";
+    }
+
+    long long start = nt_bench_now_ns();
+    pid_t pid = nt_bench_spawn(cmd, 0);
+    if(pid < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    siginfo_t info;
+    if(waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0) {
+        perror("waitid");
+        return EXIT_FAILURE;
+    }
+    long long wall = nt_bench_now_ns() - start;
+
+    nt_bench_io io;
+    nt_bench_read_io(pid, &io);
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+
+    printf("{\"label\":");
+    nt_bench_json_string(label);
+    printf(",\"cache\":\"%s\",\"exit\":%d,\"wall_us\":%lld,\"user_us\":%lld,\"sys_us\":%lld,\"maxrss_kb\":%ld,"
+           "\"syscalls\":%lld,\"syscr\":%lld,\"syscw\":%lld,\"rchar\":%lld,\"wchar\":%lld,\"read_bytes\":%lld,\"write_bytes\":%lld}\n",
+        cache,
+        WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+        wall / 1000,
+        (long long)ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec,
+        (long long)ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec,
+        ru.ru_maxrss,
+        nsyscalls,
+        io.syscr, io.syscw, io.rchar, io.wchar, io.read_bytes, io.write_bytes);
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,221 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+/*
+ * Synthetic tree generator for the benchmarks.
+ *
+ * The same options and seed always produce the same tree (names, sizes,
+ * contents, links), whatever the libc: only integer arithmetic is used, so
+ * results can be compared between commits and machines.
+ *
+ * nt_gentree [options] <root>
+ *   --seed N        PRNG seed (1)
+ *   --depth N       directory levels below root (4)
+ *   --fanout N      subdirectories per directory (4)
+ *   --files N       files per directory (16)
+ *   --min-size N    smallest file, in bytes (0)
+ *   --max-size N    largest file, in bytes (65536); sizes are about log-uniform in between
+ *   --symlinks P    percentage of entries that are symlinks (5)
+ *   --dangling P    percentage of those symlinks pointing nowhere (0), cp gives up on them
+ *   --hardlinks P   percentage of entries that are hard links to an earlier file (2)
+ *   --sparse P      percentage of files that are sparse (2)
+ *
+ * Prints a summary line on stdout:
+ * G,directories,files,symlinks,hardlinks,sparse,bytes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+typedef struct {
+    unsigned long long state;
+    int depth;
+    int fanout;
+    int files;
+    long long min_size;
+    long long max_size;
+    int symlinks;
+    int dangling;
+    int hardlinks;
+    int sparse;
+    char last_file[PATH_MAX];
+    long long n_dirs, n_files, n_symlinks, n_hardlinks, n_sparse, n_bytes;
+} nt_gentree;
+
+// xorshift64*: tiny, fast and identical everywhere
+static unsigned long long nt_gentree_rand(nt_gentree *g) {
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return g->state * 2685821657736338717ULL;
+}
+
+static int nt_gentree_percent(nt_gentree *g, int percent) {
+    return (int)(nt_gentree_rand(g) % 100) < percent;
+}
+
+// A power of two picked uniformly, then a size uniformly within it: log-uniform, near enough
+static long long nt_gentree_size(nt_gentree *g) {
+    if(g->max_size <= g->min_size) {
+        return g->min_size;
+    }
+    unsigned long long lo = g->min_size + 1, hi = g->max_size + 1;
+    int lo_bit = 63 - __builtin_clzll(lo), hi_bit = 63 - __builtin_clzll(hi);
+    int bit = lo_bit + (int)(nt_gentree_rand(g) % (hi_bit - lo_bit + 1));
+    unsigned long long from = bit == lo_bit ? lo : 1ULL << bit;
+    unsigned long long to   = bit == hi_bit ? hi : (1ULL << (bit + 1)) - 1;
+    return (long long)(from + nt_gentree_rand(g) % (to - from + 1)) - 1;
+}
+
+static int nt_gentree_write(nt_gentree *g, int fd, long long size) {
+    char buf[65536];
+    while(size > 0) {
+        int count = size > (long long)sizeof(buf) ? (int)sizeof(buf) : (int)size;
+        for(int i=0; i<count; i+=8) {
+            unsigned long long r = nt_gentree_rand(g);
+            memcpy(buf + i, &r, count - i < 8 ? count - i : 8);
+        }
+        if(write(fd, buf, count) != count) {
+            return EXIT_FAILURE;
+        }
+        size -= count;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int nt_gentree_file(nt_gentree *g, const char *path) {
+    int ret = EXIT_SUCCESS;
+    long long size = nt_gentree_size(g);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if(nt_gentree_percent(g, g->sparse)) {
+        // A little data at both ends, a hole in between
+        size = size * 64 + 65536;
+        if(EXIT_SUCCESS != nt_gentree_write(g, fd, 4096) ||
+           lseek(fd, size - 4096, SEEK_SET) < 0 ||
+           EXIT_SUCCESS != nt_gentree_write(g, fd, 4096)) {
+            ret = EXIT_FAILURE;
+        }
+        ++ g->n_sparse;
+    }
+    else {
+        ret = nt_gentree_write(g, fd, size);
+    }
+    close(fd);
+    ++ g->n_files;
+    g->n_bytes += size;
+    strcpy(g->last_file, path);
+    return ret;
+}
+
+static int nt_gentree_dir(nt_gentree *g, const char *dir, int level) {
+    char path[PATH_MAX];
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "mkdir %s: %s\n", dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    ++ g->n_dirs;
+
+    for(int i=0; i<g->files; i++) {
+        snprintf(path, sizeof(path), "%s/f%04d_%08llx", dir, i, nt_gentree_rand(g) & 0xffffffffULL);
+        int ret = EXIT_SUCCESS;
+        if(g->last_file[0] && nt_gentree_percent(g, g->hardlinks)) {
+            ret = link(g->last_file, path) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+            ++ g->n_hardlinks;
+        }
+        else if(g->last_file[0] && nt_gentree_percent(g, g->symlinks)) {
+            // Relative when in the same directory
+            const char *target = g->last_file;
+            size_t dirlen = strlen(dir);
+            if(nt_gentree_percent(g, g->dangling)) {
+                target = "does/not/exist";
+            }
+            else if(!strncmp(target, dir, dirlen) && target[dirlen] == '/') {
+                target += dirlen + 1;
+            }
+            ret = symlink(target, path) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+            ++ g->n_symlinks;
+        }
+        else {
+            ret = nt_gentree_file(g, path);
+        }
+        if(ret != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(level < g->depth) {
+        for(int i=0; i<g->fanout; i++) {
+            snprintf(path, sizeof(path), "%s/d%03d", dir, i);
+            if(EXIT_SUCCESS != nt_gentree_dir(g, path, level + 1)) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    nt_gentree g;
+    memset(&g, 0, sizeof(g));
+    g.state     = 1;
+    g.depth     = 4;
+    g.fanout    = 4;
+    g.files     = 16;
+    g.max_size  = 65536;
+    g.symlinks  = 5;
+    g.hardlinks = 2;
+    g.sparse    = 2;
+
+    int i;
+    for(i=1; i<argc && argv[i][0] == '-'; i+=2) {
+        const char *opt = argv[i];
+        char *end;
+        long long value = i + 1 < argc ? strtoll(argv[i + 1], &end, 10) : 0;
+        if(i + 1 == argc || end == argv[i + 1] || *end || value < 0) {
+            fprintf(stderr, "Usage: %s [options] <root>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        if(!strcmp(opt, "--seed"))           g.state     = value ? value : 1;
+        else if(!strcmp(opt, "--depth"))     g.depth     = (int)value;
+        else if(!strcmp(opt, "--fanout"))    g.fanout    = (int)value;
+        else if(!strcmp(opt, "--files"))     g.files     = (int)value;
+        else if(!strcmp(opt, "--min-size"))  g.min_size  = value;
+        else if(!strcmp(opt, "--max-size"))  g.max_size  = value;
+        else if(!strcmp(opt, "--symlinks"))  g.symlinks  = (int)value;
+        else if(!strcmp(opt, "--dangling"))  g.dangling  = (int)value;
+        else if(!strcmp(opt, "--hardlinks")) g.hardlinks = (int)value;
+        else if(!strcmp(opt, "--sparse"))    g.sparse    = (int)value;
+        else {
+            fprintf(stderr, "Unknown option %s\nUsage: %s [options] <root>\n", opt, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(i != argc - 1) {
+        fprintf(stderr, "Usage: %s [options] <root>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Symlink targets outside of their own directory are absolute
+    char root[PATH_MAX];
+    if(argv[i][0] == '/') {
+        snprintf(root, sizeof(root), "%s", argv[i]);
+    }
+    else if(getcwd(root, sizeof(root))) {
+        snprintf(root + strlen(root), sizeof(root) - strlen(root), "/%s", argv[i]);
+    }
+    if(EXIT_SUCCESS != nt_gentree_dir(&g, root, 0)) {
+        return EXIT_FAILURE;
+    }
+    printf("G,%lld,%lld,%lld,%lld,%lld,%lld\n", g.n_dirs, g.n_files, g.n_symlinks, g.n_hardlinks, g.n_sparse, g.n_bytes);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -22,21 +22,120 @@ typedef enum {
  * than having a bunch of malloc/free.
  */
 
+// 100, 64k, 10M... (powers of 1024)
+static long long nt_parse_amount(const char *s) {
+    char *end;
+    int shift = 0;
+    errno = 0;
+    long long value = strtoll(s, &end, 10);
+    switch(*end) {
+        case 'k': case 'K': shift = 10; ++end; break;
+        case 'm': case 'M': shift = 20; ++end; break;
+        case 'g': case 'G': shift = 30; ++end; break;
+    }
+    if(end == s || *end || errno || value < 0 || value > (LLONG_MAX >> shift)) {
+        return -1;
+    }
+    return value << shift;
+}
+
+/*
+ * Options understood by every applet. They go right before or right after
+ * the applet name, e.g. nativetools --fd-budget=16 cr /sdcard
+ */
+static int nt_global_options(int *argc, char ***argv) {
+    while(*argc > 1 && !strncmp((*argv)[1], "--", 2)) {
+        char *opt = (*argv)[1];
+        if(!strncmp(opt, "--fd-budget=", 12)) {
+            char *end;
+            errno = 0;
+            long budget = strtol(opt + 12, &end, 10);
+            if(end == opt + 12 || *end || errno || budget < 1 || budget > INT_MAX) {
+                return nt_error("Invalid descriptor budget in %s", opt);
+            }
+            work_fd_budget = budget;
+        }
+        else if(!strcmp(opt, "--stats")) {
+#if defined(NT_NO_STATS)
+            return nt_error("This build has no --stats support");
+#else
+            work_stats = 1;
+#endif
+        }
+        else if(!strncmp(opt, "--trace=", 8)) {
+#if defined(NT_NO_TRACE)
+            return nt_error("This build has no --trace support");
+#else
+            work_trace = opt + 8;
+            nt_trace_enable();
+#endif
+        }
+        else if(!strcmp(opt, "--qos=idle")) {
+            work_ioprio_class = NT_IOPRIO_CLASS_IDLE;
+            work_ioprio_level = 0;
+        }
+        else if(!strncmp(opt, "--qos=be", 8) && (opt[8] == '\0' || (opt[8] == ':' && opt[9] >= '0' && opt[9] <= '7' && !opt[10]))) {
+            work_ioprio_class = NT_IOPRIO_CLASS_BE;
+            work_ioprio_level = opt[8] ? opt[9] - '0' : 4;
+        }
+        else if(!strncmp(opt, "--max-bps=", 10)) {
+            long long bps = nt_parse_amount(opt + 10);
+            if(bps < 0) {
+                return nt_error("Invalid amount in %s", opt);
+            }
+            work_max_bps = bps;
+        }
+        else if(!strncmp(opt, "--max-ops=", 10)) {
+            long long ops = nt_parse_amount(opt + 10);
+            if(ops < 0) {
+                return nt_error("Invalid amount in %s", opt);
+            }
+            work_max_ops = ops;
+        }
+        else if(!strcmp(opt, "--order=disk")) {
+            work_order = NT_ORDER_DISK;
+        }
+        else if(!strcmp(opt, "--order=inode")) {
+            work_order = NT_ORDER_INODE;
+        }
+        else if(!strcmp(opt, "--order=name")) {
+            work_order = NT_ORDER_NAME;
+        }
+        else {
+            return nt_error("Unknown option %s", opt);
+        }
+        (*argv)[1] = (*argv)[0];
+        --(*argc);
+        ++(*argv);
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv, char** env) {
     int exit_code = EXIT_FAILURE;
 
     // Nothing to be proud of but, hey,
     // argv is not immutable.
     argv[0] = nt_basename(argv[0]);
+    if(EXIT_SUCCESS != nt_global_options(&argc, &argv)) {
+        return exit_code;
+    }
     if(argc > 1 && !strcmp(argv[0], NT_BIN_NAME)) {
         --argc;
         ++argv;
         argv[0] = nt_basename(argv[0]);
+        if(EXIT_SUCCESS != nt_global_options(&argc, &argv)) {
+            return exit_code;
+        }
     }
     // Else:
     // We are using a link, rather than passing
     // our action name as an argument
 
+    if(EXIT_SUCCESS != nt_qos_apply()) {
+        return exit_code;
+    }
+
     for(int i=0; i<APPLETS_COUNT; i++) {
         if(!strcmp(applets[i].keyword, argv[0])) {
             exit_code = (applets[i].fn)(argc, argv, env);
@@ -44,5 +143,18 @@ int main(int argc, char** argv, char** env) {
         }
     }
 
+#if !defined(NT_NO_STATS)
+    if(work_stats) {
+        fflush(stdout);
+        nt_stats_report();
+    }
+#endif
+#if !defined(NT_NO_TRACE)
+    if(work_trace) {
+        nt_trace_flush(stdout);
+        nt_trace_write(work_trace);
+    }
+#endif
+
     return exit_code;
 }
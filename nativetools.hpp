@@ -13,7 +13,9 @@
 	#include <unistd.h>
 	#include <dirent.h>
 	#include <pwd.h>
+	#include <grp.h>
 	#include <fcntl.h>
+	#include <pthread.h>
 
 	#define NT_OS_WIN32	0x01
 	#define NT_OS_UNIX  0x02
@@ -26,14 +28,137 @@
 
 	#define NT_BIN_NAME "nativetools"
 
+	// Upper bound for nt_parallel_for() workers, including the calling thread.
+	#define NT_MAX_THREADS 16
+
+	// Default number of directories nt_walk() keeps open at once, see --fd-budget
+	#define NT_WALK_FD_BUDGET 32
+
+	// Bump allocator, see nt_utils.cpp
+	#define NT_ARENA_BLOCK 65536
+
+	typedef struct nt_arena_block nt_arena_block;
+
+	typedef struct {
+		nt_arena_block *top;
+		nt_arena_block *spare;
+	} nt_arena;
+
+	typedef struct {
+		nt_arena_block *block;
+		size_t used;
+	} nt_arena_mark;
+
+	/*
+	 * I/O calls counted and timed by --stats. Build with -DNT_NO_STATS
+	 * to compile the instrumentation out entirely.
+	 */
+	#define NT_OP_OPENDIR  0
+	#define NT_OP_READDIR  1
+	#define NT_OP_LSTAT    2
+	#define NT_OP_READLINK 3
+	#define NT_OP_OPEN     4
+	#define NT_OP_READ     5
+	#define NT_OP_WRITE    6
+	#define NT_OP_CHOWN    7
+	#define NT_OP_UNLINK   8
+	#define NT_OP_MKDIR    9
+	#define NT_OP_RMDIR    10
+	#define NT_OP_COUNT    11
+
+	#if defined(NT_NO_STATS)
+		#define NT_IO(op, call) (call)
+		#define NT_IO_BYTES(op, count)
+	#else
+		#define NT_IO(op, call) ({ \
+			unsigned long long nt_io_start = nt_stats_begin(); \
+			__typeof__(call) nt_io_ret = (call); \
+			nt_stats_end(op, nt_io_start); \
+			nt_io_ret; })
+		#define NT_IO_BYTES(op, count) nt_stats_bytes(op, count)
+
+		unsigned long long nt_stats_begin();
+		void nt_stats_end(int, unsigned long long);
+		void nt_stats_bytes(int, long long);
+		void nt_stats_report();
+	#endif
+
+	/*
+	 * Spans written out by --trace. Build with -DNT_NO_TRACE to compile
+	 * them out entirely.
+	 */
+	#if defined(NT_NO_TRACE)
+		#define NT_TRACE_BEGIN() 0ULL
+		#define NT_TRACE_END(name, detail, start) ((void)(start))
+	#else
+		#define NT_TRACE_BEGIN() nt_trace_begin()
+		#define NT_TRACE_END(name, detail, start) nt_trace_end(name, detail, start)
+
+		void nt_trace_enable();
+		unsigned long long nt_trace_begin();
+		void nt_trace_end(const char*, const char*, unsigned long long);
+		void nt_trace_flush(FILE*);
+		int nt_trace_write(const char*);
+	#endif
+
+	// I/O scheduling classes for --qos, as in linux/ioprio.h
+	#define NT_IOPRIO_CLASS_NONE 0
+	#define NT_IOPRIO_CLASS_BE   2
+	#define NT_IOPRIO_CLASS_IDLE 3
+
+	// Order in which nt_walk() stats and visits the entries of a directory, see --order
+	#define NT_ORDER_DISK  0
+	#define NT_ORDER_INODE 1
+	#define NT_ORDER_NAME  2
+
+	// What a nt_walk() visitor wants done with the entry it was given
+	#define NT_WALK_CONTINUE 0
+	#define NT_WALK_DESCEND  1
+	#define NT_WALK_FAIL     2
+
+	typedef struct {
+		char *path;         // Full path of the entry, may be longer than PATH_MAX
+		char *name;         // Entry name, points inside path
+		int dirfd;          // Directory being read, for the *at() calls
+		struct stat sf;     // Always from lstat()
+		int depth;          // 1 for the children of the walk's root
+		char *parent_aux;   // aux/tag given to the directory being read
+		long parent_tag;
+		char *aux;          // May be set by the visitor before returning NT_WALK_DESCEND,
+		long tag;           // aux must then be allocated from arena
+		nt_arena *arena;    // Reset after each entry unless it is descended into
+	} nt_walk_entry;
+
+	typedef struct {
+		int passes;         // Each directory is read this many times (1 or 2)
+		int keep_going;     // Do not stop at the first failure
+		int (*visit)(nt_walk_entry*, int pass, void *ctx);
+		int (*leave)(nt_walk_entry*, void *ctx); // Descended directory is done, optional
+		void *ctx;
+	} nt_walk_ops;
+
 	int nt_error(const char*, ...);
 	char nt_separator();
 	char *nt_basename(const char*);
 	int nt_listdir(const char*);
+	void *nt_arena_alloc(nt_arena*, size_t);
+	char *nt_arena_path(nt_arena*, const char*, const char*);
+	nt_arena_mark nt_arena_save(nt_arena*);
+	void nt_arena_release(nt_arena*, nt_arena_mark);
+	void nt_arena_free(nt_arena*);
+	int nt_copyfile(char*, char*, struct stat*);
 	int nt_cpfile(char*, char*, char*, struct stat*);
 	int nt_cpdir(char*, char*);
 	int nt_rmdir(char*);
 	int nt_fileop(char*, int, int, int (*cb)(char*, int, struct stat*));
+	int nt_walk(char*, char*, long, nt_walk_ops*);
+	int nt_qos_apply();
+	void nt_qos_bytes(long long);
+	void nt_qos_ops(long long);
+	const char *nt_user_name(uid_t);
+	const char *nt_group_name(gid_t);
+	int nt_cpu_count();
+	int nt_parallel_for(int, int, void (*fn)(int, void*), void*);
 
 	/*
 	 * Some functions use these globals and can therefore not be used
@@ -42,9 +167,25 @@
 	#if defined(NATIVETOOLS_MAIN)
 		unsigned int work_index = 0;
 		unsigned int work_uid;
+		unsigned int work_fd_budget = NT_WALK_FD_BUDGET;
+		int work_order = NT_ORDER_DISK;
+		int work_stats = 0;
+		const char *work_trace = 0;
+		int work_ioprio_class = NT_IOPRIO_CLASS_NONE;
+		int work_ioprio_level = 0;
+		long long work_max_bps = 0;
+		long long work_max_ops = 0;
 	#else
 		extern unsigned int work_index;
 		extern unsigned int work_uid;
+		extern unsigned int work_fd_budget;
+		extern int work_order;
+		extern int work_stats;
+		extern const char *work_trace;
+		extern int work_ioprio_class;
+		extern int work_ioprio_level;
+		extern long long work_max_bps;
+		extern long long work_max_ops;
 	#endif
 
 #endif /* NATIVETOOLS_GLOBAL_HPP */
\ No newline at end of file
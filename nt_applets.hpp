@@ -15,18 +15,23 @@
 	// ********************************
 	// C++ Applets are registered here:
 	// ********************************
+	APPLET(nt_bulk_stat);
 	APPLET(nt_df);
 	APPLET(nt_du);
 	APPLET(nt_file_exists);
 	APPLET(nt_get_owner);
+	APPLET(nt_link_audit);
 	APPLET(nt_list_links);
 	APPLET(nt_mount_loop);
 	APPLET(nt_mount_read_write);
+	APPLET(nt_move);
 	APPLET(nt_read_file);
 	APPLET(nt_recursive_chown);
 	APPLET(nt_recursive_cp);
 	APPLET(nt_recursive_crawl);
 	APPLET(nt_recursive_remove);	
+	APPLET(nt_tar_create);
+	APPLET(nt_tar_extract);
 
 	// ********************************
 	// C Applets are registered here:
@@ -54,6 +59,11 @@
 		{"co", &nt_recursive_chown},
 		{"cp", &nt_recursive_cp},
 		{"cr", &nt_recursive_crawl},
-		{"rm", &nt_recursive_remove}
+		{"rm", &nt_recursive_remove},
+		{"st", &nt_bulk_stat},
+		{"mv", &nt_move},
+		{"tc", &nt_tar_create},
+		{"tx", &nt_tar_extract},
+		{"la", &nt_link_audit}
 	};
 #endif /* NATIVETOOLS_APPLETS_HPP */
\ No newline at end of file
@@ -0,0 +1,123 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+
+// Paths stat'ed before each round of output, keeps memory flat on huge lists
+#define NT_BULK_STAT_CHUNK 4096
+
+typedef struct {
+    char *path;
+    struct stat sf;
+    int err;
+} nt_bulk_stat_item;
+
+static char *nt_bulk_stat_read(int fd, size_t *len) {
+    size_t size = 16384;
+    char *buf = (char*)malloc(size + 1);
+    *len = 0;
+    while(buf) {
+        if(*len == size) {
+            size *= 2;
+            char *grown = (char*)realloc(buf, size + 1);
+            if(!grown) {
+                free(buf);
+                return 0;
+            }
+            buf = grown;
+        }
+        ssize_t count = read(fd, buf + *len, size - *len);
+        if(0 > count && errno == EINTR) {
+            continue;
+        }
+        if(0 >= count) {
+            break;
+        }
+        *len += count;
+    }
+    // Last path does not need its own terminator
+    if(buf) {
+        buf[*len] = '\0';
+    }
+    return buf;
+}
+
+static void nt_bulk_stat_one(int i, void *ctx) {
+    nt_bulk_stat_item *item = &((nt_bulk_stat_item*)ctx)[i];
+    item->err = fstatat(AT_FDCWD, item->path, &item->sf, AT_SYMLINK_NOFOLLOW) < 0 ? errno : 0;
+}
+
+static char nt_bulk_stat_type(mode_t mode) {
+    return S_ISREG(mode)  ? 'f' :
+           S_ISDIR(mode)  ? 'd' :
+           S_ISLNK(mode)  ? 'l' :
+           S_ISCHR(mode)  ? 'c' :
+           S_ISBLK(mode)  ? 'b' :
+           S_ISFIFO(mode) ? 'p' :
+           S_ISSOCK(mode) ? 's' : '?';
+}
+
+/*
+ * Reads a NUL-delimited list of paths on stdin, e.g. from `find -print0`.
+ * With -0, records are NUL-terminated too so paths may contain newlines.
+ */
+int nt_bulk_stat(int argc, char** argv, char** env) {
+    int ret = EXIT_SUCCESS;
+
+    if(argc > 2 || (argc == 2 && strcmp(argv[1], "-0"))) {
+        ret = nt_error("Wrong # of arguments for %s: %d", __FUNCTION__, argc);
+    }
+    else {
+        char eol = argc == 2 ? '\0' : '\n';
+        size_t len;
+        char *input = nt_bulk_stat_read(STDIN_FILENO, &len);
+        nt_bulk_stat_item *items = (nt_bulk_stat_item*)malloc(sizeof(nt_bulk_stat_item) * NT_BULK_STAT_CHUNK);
+        int nthreads = nt_cpu_count() * 2;
+        if(!input || !items) {
+            free(items);
+            free(input);
+            return nt_error("Out of memory");
+        }
+
+        char *next = input;
+        char *end  = input + len;
+        while(next < end) {
+            int count = 0;
+            while(next < end && count < NT_BULK_STAT_CHUNK) {
+                if(*next) {
+                    items[count++].path = next;
+                }
+                next += strlen(next) + 1;
+            }
+
+            nt_parallel_for(count, nthreads, nt_bulk_stat_one, items);
+
+            for(int i=0; i<count; i++) {
+                nt_bulk_stat_item *item = &items[i];
+                if(item->err == ENOENT || item->err == ENOTDIR) {
+                    // S,n,-,0,-,-,0,path
+                    printf("S,n,-,0,-,-,0,%s%c", item->path, eol);
+                }
+                else if(item->err) {
+                    // Exists or not, we cannot tell (EACCES, ELOOP, EIO...): S,e,errno,0,-,-,0,path
+                    ret = EXIT_FAILURE;
+                    printf("S,e,%d,0,-,-,0,%s%c", item->err, item->path, eol);
+                }
+                else {
+                    // S,exists,type,size,owner,group,mode,path
+                    printf("S,y,%c,%lld,%s,%s,%o,%s%c",
+                        nt_bulk_stat_type(item->sf.st_mode),
+                        (long long)item->sf.st_size,
+                        nt_user_name(item->sf.st_uid),
+                        nt_group_name(item->sf.st_gid),
+                        (unsigned int)(item->sf.st_mode & 07777),
+                        item->path,
+                        eol);
+                }
+            }
+        }
+
+        free(items);
+        free(input);
+    }
+    return ret;
+}
\ No newline at end of file
@@ -1,14 +1,207 @@
 // (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
 
 #include "nativetools.hpp"
+#include <sys/sysmacros.h>
+
+#define NT_DF_MOUNTINFO "/proc/self/mountinfo"
+
+/*
+ * Filesystems that never hold user data: reporting them would only
+ * give the caller more lines to throw away.
+ */
+static const char *nt_df_pseudo[] = {
+    "autofs", "binder", "binderfs", "bpf", "cgroup", "cgroup2", "configfs",
+    "debugfs", "devpts", "functionfs", "fusectl", "hugetlbfs", "mqueue",
+    "proc", "pstore", "rootfs", "securityfs", "selinuxfs", "sysfs", "tracefs",
+    0
+};
+
+typedef struct {
+    unsigned int major;
+    unsigned int minor;
+    char *root;
+    char *mountpoint;
+    char *fstype;
+} nt_df_mount;
+
+typedef struct {
+    const char *path;
+    nt_df_mount *mount;
+    struct statfs st;
+    int status;
+} nt_df_query;
+
+static int nt_df_is_pseudo(const char *fstype) {
+    for(int i=0; nt_df_pseudo[i]; i++) {
+        if(!strcmp(nt_df_pseudo[i], fstype)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// mountinfo escapes blanks and backslashes as \ooo
+static void nt_df_unescape(char *s) {
+    char *out = s;
+    while(*s) {
+        if(s[0] == '\\' && s[1] >= '0' && s[1] <= '7' && s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+            *out++ = (char)(((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0'));
+            s += 4;
+        }
+        else {
+            *out++ = *s++;
+        }
+    }
+    *out = '\0';
+}
+
+/*
+ * Line format (see proc(5)):
+ * 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+ */
+static int nt_df_parse_line(char *line, nt_df_mount *m) {
+    char *fields[6];
+    char *save = 0;
+    char *tok = 0;
+    int n = 0;
+    while(n < 6 && 0 != (tok = strtok_r(n ? 0 : line, " \n", &save))) {
+        fields[n++] = tok;
+    }
+    if(n < 6 || 2 != sscanf(fields[2], "%u:%u", &m->major, &m->minor)) {
+        return EXIT_FAILURE;
+    }
+    // Skip optional fields up to the separator
+    while(0 != (tok = strtok_r(0, " \n", &save)) && strcmp(tok, "-")) {}
+    if(!tok || 0 == (tok = strtok_r(0, " \n", &save))) {
+        return EXIT_FAILURE;
+    }
+    nt_df_unescape(fields[3]);
+    nt_df_unescape(fields[4]);
+    m->root       = strdup(fields[3]);
+    m->mountpoint = strdup(fields[4]);
+    m->fstype     = strdup(tok);
+    return EXIT_SUCCESS;
+}
+
+static int nt_df_load_mounts(nt_df_mount **mounts) {
+    int count = 0, size = 0;
+    *mounts = 0;
+
+    FILE *f = fopen(NT_DF_MOUNTINFO, "r");
+    if(!f) {
+        return -1;
+    }
+    char line[8192];
+    while(fgets(line, sizeof(line), f)) {
+        nt_df_mount m;
+        if(EXIT_SUCCESS != nt_df_parse_line(line, &m)) {
+            continue;
+        }
+        if(count == size) {
+            size = size ? size * 2 : 32;
+            *mounts = (nt_df_mount*)realloc(*mounts, sizeof(nt_df_mount) * size);
+        }
+        (*mounts)[count++] = m;
+    }
+    fclose(f);
+
+    return count;
+}
+
+static void nt_df_free_mounts(nt_df_mount *mounts, int count) {
+    for(int i=0; i<count; i++) {
+        free(mounts[i].root);
+        free(mounts[i].mountpoint);
+        free(mounts[i].fstype);
+    }
+    free(mounts);
+}
+
+/*
+ * Find the mount a path lives on: same device and longest mount point
+ * that prefixes the resolved path. Later entries win ties since they
+ * are mounted on top of earlier ones.
+ */
+static nt_df_mount *nt_df_find_mount(const char *path, nt_df_mount *mounts, int count) {
+    struct stat sf;
+    char resolved[PATH_MAX];
+    if(stat(path, &sf) < 0 || !realpath(path, resolved)) {
+        return 0;
+    }
+
+    nt_df_mount *found = 0;
+    size_t found_len = 0;
+    for(int i=0; i<count; i++) {
+        nt_df_mount *m = &mounts[i];
+        if(m->major != major(sf.st_dev) || m->minor != minor(sf.st_dev)) {
+            continue;
+        }
+        size_t len = strlen(m->mountpoint);
+        if(len == 1) {
+            len = 0; // "/" prefixes everything
+        }
+        if(strncmp(m->mountpoint, resolved, len) || (resolved[len] != '\0' && resolved[len] != '/')) {
+            continue;
+        }
+        if(!found || len >= found_len) {
+            found = m;
+            found_len = len;
+        }
+    }
+    return found;
+}
+
+/*
+ * One line per mount. A mount point that was mounted over only shows the
+ * last filesystem mounted there, which is also all statfs() can reach.
+ * Bind mounts share a device with the mount they were taken from; only keep
+ * the one exposing the filesystem's root, or the first one seen if none does.
+ */
+static int nt_df_overmounted(nt_df_mount *mounts, int count, int i) {
+    for(int j=i+1; j<count; j++) {
+        if(!strcmp(mounts[j].mountpoint, mounts[i].mountpoint)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int nt_df_select_mounts(nt_df_mount *mounts, int count, nt_df_query *queries) {
+    int selected = 0;
+    for(int i=0; i<count; i++) {
+        nt_df_mount *m = &mounts[i];
+        if(nt_df_is_pseudo(m->fstype) || nt_df_overmounted(mounts, count, i)) {
+            continue;
+        }
+        int dup = -1;
+        for(int j=0; j<selected; j++) {
+            if(queries[j].mount->major == m->major && queries[j].mount->minor == m->minor) {
+                dup = j;
+                break;
+            }
+        }
+        if(dup < 0) {
+            queries[selected].path  = m->mountpoint;
+            queries[selected].mount = m;
+            ++ selected;
+        }
+        else if(strcmp(queries[dup].mount->root, "/") && !strcmp(m->root, "/")) {
+            queries[dup].path  = m->mountpoint;
+            queries[dup].mount = m;
+        }
+    }
+    return selected;
+}
+
+static void nt_df_statfs(int i, void *ctx) {
+    nt_df_query *q = &((nt_df_query*)ctx)[i];
+    q->status = statfs(q->path, &q->st) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
 int nt_df(int argc, char** argv, char** env) {
     int ret = EXIT_SUCCESS;
 
-    if(argc != 2) {
-        ret = nt_error("Wrong # of arguments for %s: %d", __FUNCTION__, argc);
-    }
-    else {
+    if(argc == 2) {
         char *s = argv[1];
         struct statfs st;
 
@@ -24,5 +217,77 @@ int nt_df(int argc, char** argv, char** env) {
                 (int) st.f_bsize);
         }
     }
+    else {
+        nt_df_mount *mounts;
+        int count = nt_df_load_mounts(&mounts);
+        if(count < 0) {
+            return nt_error("Cannot read %s", NT_DF_MOUNTINFO);
+        }
+
+        int qcount = argc > 1 ? argc - 1 : count;
+        nt_df_query *queries = (nt_df_query*)calloc(qcount ? qcount : 1, sizeof(nt_df_query));
+        if(!queries) {
+            nt_df_free_mounts(mounts, count);
+            return nt_error("Out of memory");
+        }
+        if(argc > 1) {
+            for(int i=0; i<qcount; i++) {
+                queries[i].path  = argv[i + 1];
+                queries[i].mount = nt_df_find_mount(argv[i + 1], mounts, count);
+            }
+        }
+        else {
+            qcount = nt_df_select_mounts(mounts, count, queries);
+        }
+
+        // A stale network or FUSE mount can block statfs() for a long time,
+        // do not let it hold up every other line.
+        nt_parallel_for(qcount, NT_MAX_THREADS, nt_df_statfs, queries);
+
+        size_t failed_len = 0;
+        for(int i=0; i<qcount; i++) {
+            nt_df_query *q = &queries[i];
+            if(q->status != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+                failed_len += strlen(q->path) + 2;
+                continue;
+            }
+            // Nothing allocated: some pseudo-filesystem we do not know about
+            if(argc == 1 && q->st.f_blocks == 0) {
+                continue;
+            }
+            // D,total,used,available,block_size,inodes,inodes_used,inodes_free,type,mount_point
+            printf("D,%lld,%lld,%lld,%d,%lld,%lld,%lld,%s,%s\n",
+                ((long long)q->st.f_blocks * (long long)q->st.f_bsize) / 1024,
+                ((long long)(q->st.f_blocks - (long long)q->st.f_bfree) * q->st.f_bsize) / 1024,
+                ((long long)q->st.f_bfree * (long long)q->st.f_bsize) / 1024,
+                (int) q->st.f_bsize,
+                (long long)q->st.f_files,
+                (long long)(q->st.f_files - q->st.f_ffree),
+                (long long)q->st.f_ffree,
+                q->mount ? q->mount->fstype : "-",
+                q->mount ? q->mount->mountpoint : q->path);
+        }
+        if(failed_len) {
+            // A single message, as they would otherwise run together
+            char *failed = (char*)malloc(failed_len);
+            if(failed) {
+                failed[0] = '\0';
+                for(int i=0; i<qcount; i++) {
+                    if(queries[i].status != EXIT_SUCCESS) {
+                        if(failed[0]) {
+                            strcat(failed, ", ");
+                        }
+                        strcat(failed, queries[i].path);
+                    }
+                }
+            }
+            nt_error("statfs failed for %s", failed ? failed : "several paths");
+            free(failed);
+        }
+
+        free(queries);
+        nt_df_free_mounts(mounts, count);
+    }
     return ret;
 }
\ No newline at end of file
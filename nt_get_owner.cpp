@@ -16,15 +16,8 @@ int nt_get_owner(int argc, char** argv, char** env) {
             ret = EXIT_FAILURE;
         }
         else {
-            char user[16];
-            struct passwd *pw = getpwuid(sf.st_uid);
-            if(pw) {
-                strcpy(user, pw->pw_name);
-            } else {
-                sprintf(user, "%lu", sf.st_uid);
-            }        
             // O,name
-            printf("O,%s", user);
+            printf("O,%s", nt_user_name(sf.st_uid));
         }
     }
     return ret;
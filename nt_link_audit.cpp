@@ -0,0 +1,485 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+
+/*
+ * la [-r <root path>] <directory path>
+ *
+ * Walks the tree and reports the symbolic links that will bite whoever
+ * follows them (cp does):
+ *   A,d,<link path>,<target>   dangling, the target does not exist
+ *   A,e,<link path>,<target>   escapes <root path> (the directory by default)
+ *   A,c,<link path>,<target>   cycle: points to one of its own parent
+ *                              directories, or to a loop of links
+ * followed by a summary, T,<links>,<dangling>,<escaping>,<cycles>
+ *
+ * Links are gathered per directory while it is read, then read back
+ * together with readlinkat() on a duplicate of the walker's fd for that
+ * directory, which stays valid whatever the walker closes meanwhile and
+ * however long the path. Targets are
+ * resolved once per distinct parent directory within that batch, as the
+ * links of a directory tend to point next to each other (/data/app-lib/...,
+ * ../lib...). Cycles are told by comparing the (dev, ino) of a directory
+ * target with those of the link's ancestors. Links that only loop through
+ * one another (a/tob -> ../b, b/toa -> ../a) are found once the walk is
+ * over: following a directory link leads to every directory link below its
+ * target, and the links that can get back to themselves that way are
+ * reported as well. Only directories the walk went through are known, so a
+ * loop that goes through the rest of the filesystem is not found.
+ */
+
+#define NT_AUDIT_BATCH 64
+#define NT_AUDIT_CACHE 16
+
+// Every directory walked, in the order it was entered
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int last;           // Index of the last directory below it
+} nt_audit_dir;
+
+typedef struct {
+    int at;             // Directory the link is in
+    dev_t dev;          // Directory it points to
+    ino_t ino;
+    char *path;
+    char *target;
+    int reported;
+} nt_audit_dirlink;
+
+typedef struct {
+    char key[PATH_MAX * 2];     // Parent directory of a target, as written
+    char resolved[PATH_MAX];    // Its realpath()
+    int err;                    // Or why it could not be resolved
+} nt_audit_cached;
+
+typedef struct {
+    char root[PATH_MAX];
+    size_t rootlen;
+    nt_audit_dir *dirs;
+    int dir_count, dir_size;
+    int *anc;           // anc[i]: directory at depth i, the walk's root being 0
+    int anc_size;
+    nt_audit_dirlink *dirlinks;
+    int dirlink_count, dirlink_size;
+    char *dir;          // Directory the batch comes from
+    int dirfd;          // Open on it, -1 if dup() failed
+    int depth;          // Depth of the links in the batch
+    char *names[NT_AUDIT_BATCH];
+    int count;
+    nt_audit_cached cache[NT_AUDIT_CACHE];
+    int cached;
+    long long links, dangling, escaping, cycles;
+} nt_audit_ctx;
+
+static void nt_audit_report(nt_audit_ctx *a, char kind, const char *name, const char *target) {
+    printf("A,%c,%s%c%s,%s\n", kind, a->dir, nt_separator(), name, target);
+}
+
+// realpath() of a target's parent directory, looked up once per batch
+static const char *nt_audit_parent(nt_audit_ctx *a, const char *parent, int *err) {
+    for(int i=0; i<a->cached; i++) {
+        if(!strcmp(a->cache[i].key, parent)) {
+            *err = a->cache[i].err;
+            return a->cache[i].err ? 0 : a->cache[i].resolved;
+        }
+    }
+    // Once full, the last slot is recycled
+    nt_audit_cached *c = &a->cache[a->cached < NT_AUDIT_CACHE ? a->cached++ : NT_AUDIT_CACHE - 1];
+    snprintf(c->key, sizeof(c->key), "%s", parent);
+    c->err = realpath(parent, c->resolved) ? 0 : errno;
+    *err = c->err;
+    return c->err ? 0 : c->resolved;
+}
+
+static int nt_audit_inside(nt_audit_ctx *a, const char *path) {
+    if(a->rootlen == 1) {
+        return 1;
+    }
+    return !strncmp(path, a->root, a->rootlen) && (path[a->rootlen] == '\0' || path[a->rootlen] == nt_separator());
+}
+
+static void nt_audit_link(nt_audit_ctx *a, int dirfd, const char *name) {
+    char target[PATH_MAX], full[PATH_MAX * 2], canonical[PATH_MAX * 2];
+    ssize_t len = NT_IO(NT_OP_READLINK, readlinkat(dirfd, name, target, sizeof(target) - 1));
+    if(len < 0) {
+        nt_error("Cannot read link %s%c%s", a->dir, nt_separator(), name);
+        return;
+    }
+    target[len] = '\0';
+    ++ a->links;
+
+    if(target[0] == nt_separator()) {
+        snprintf(full, sizeof(full), "%s", target);
+    }
+    else {
+        snprintf(full, sizeof(full), "%s%c%s", a->dir, nt_separator(), target);
+    }
+
+    // Parent through the cache, last component by hand unless it needs resolving itself
+    int unresolved = 0;
+    char *slash = strrchr(full, nt_separator());
+    const char *base = slash + 1;
+    if(slash == full) {
+        snprintf(canonical, sizeof(canonical), "%c%s", nt_separator(), base);
+    }
+    else {
+        *slash = '\0';
+        const char *parent = nt_audit_parent(a, full, &unresolved);
+        *slash = nt_separator();
+        if(parent) {
+            snprintf(canonical, sizeof(canonical), "%s%c%s", strcmp(parent, "/") ? parent : "", nt_separator(), base);
+        }
+    }
+    struct stat sf;
+    if(!unresolved && (!*base || !strcmp(base, ".") || !strcmp(base, "..") ||
+                (0 == lstat(canonical, &sf) && S_ISLNK(sf.st_mode)))) {
+        char *resolved = realpath(full, 0);
+        if(resolved) {
+            snprintf(canonical, sizeof(canonical), "%s", resolved);
+            free(resolved);
+        }
+        else {
+            unresolved = errno;
+        }
+    }
+    // Relative to the link itself, as following it would. The canonical
+    // path only tells escapes, and may be out of reach (ENAMETOOLONG)
+    int err = 0 != fstatat(dirfd, target, &sf, 0) ? errno : 0;
+
+    if(err == ELOOP) {
+        ++ a->cycles;
+        nt_audit_report(a, 'c', name, target);
+        return;
+    }
+    if(err) {
+        ++ a->dangling;
+        nt_audit_report(a, 'd', name, target);
+        return;
+    }
+    if(!unresolved && !nt_audit_inside(a, canonical)) {
+        ++ a->escaping;
+        nt_audit_report(a, 'e', name, target);
+    }
+    if(S_ISDIR(sf.st_mode)) {
+        int reported = 0;
+        for(int i=0; i<a->depth && i<a->anc_size && !reported; i++) {
+            nt_audit_dir *d = &a->dirs[a->anc[i]];
+            if(d->dev == sf.st_dev && d->ino == sf.st_ino) {
+                ++ a->cycles;
+                nt_audit_report(a, 'c', name, target);
+                reported = 1;
+            }
+        }
+        // Kept for nt_audit_loops()
+        if(a->dirlink_count == a->dirlink_size) {
+            int size = a->dirlink_size ? a->dirlink_size * 2 : 64;
+            nt_audit_dirlink *dirlinks = (nt_audit_dirlink*)realloc(a->dirlinks, sizeof(nt_audit_dirlink) * size);
+            if(!dirlinks) {
+                return;
+            }
+            a->dirlinks = dirlinks;
+            a->dirlink_size = size;
+        }
+        nt_audit_dirlink *l = &a->dirlinks[a->dirlink_count];
+        snprintf(full, sizeof(full), "%s%c%s", a->dir, nt_separator(), name);
+        l->at       = a->anc[a->depth - 1];
+        l->dev      = sf.st_dev;
+        l->ino      = sf.st_ino;
+        l->path     = strdup(full);
+        l->target   = strdup(target);
+        l->reported = reported;
+        if(l->path && l->target) {
+            ++ a->dirlink_count;
+        }
+        else {
+            free(l->path);
+            free(l->target);
+        }
+    }
+}
+
+static void nt_audit_flush(nt_audit_ctx *a) {
+    if(a->count) {
+        unsigned long long span = NT_TRACE_BEGIN();
+        for(int i=0; i<a->count; i++) {
+            if(a->dirfd < 0) {
+                nt_error("Cannot read link %s%c%s", a->dir, nt_separator(), a->names[i]);
+            }
+            else {
+                nt_audit_link(a, a->dirfd, a->names[i]);
+            }
+            free(a->names[i]);
+        }
+        if(a->dirfd >= 0) {
+            close(a->dirfd);
+            a->dirfd = -1;
+        }
+        a->count = 0;
+        NT_TRACE_END("audit", a->dir, span);
+    }
+    a->cached = 0;
+}
+
+static int nt_audit_by_at(const void *x, const void *y) {
+    return ((nt_audit_dirlink*)x)->at - ((nt_audit_dirlink*)y)->at;
+}
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int dir;
+} nt_audit_id;
+
+static int nt_audit_by_id(const void *x, const void *y) {
+    const nt_audit_id *ix = (const nt_audit_id*)x, *iy = (const nt_audit_id*)y;
+    if(ix->dev != iy->dev) {
+        return ix->dev < iy->dev ? -1 : 1;
+    }
+    return ix->ino < iy->ino ? -1 : ix->ino > iy->ino ? 1 : 0;
+}
+
+/*
+ * The links that can be followed right after l: those in or below the
+ * directory it points to. Directories are numbered in the order they were
+ * entered, so these have dir <= at <= last, a range of the links sorted by
+ * at.
+ */
+static void nt_audit_next(nt_audit_ctx *a, nt_audit_id *byid, nt_audit_dirlink *l, int *lo, int *hi) {
+    *lo = *hi = 0;
+    nt_audit_id key = {l->dev, l->ino, 0};
+    nt_audit_id *found = (nt_audit_id*)bsearch(&key, byid, a->dir_count, sizeof(nt_audit_id), nt_audit_by_id);
+    if(!found) {
+        // Outside of the tree, where nothing was walked
+        return;
+    }
+    int dir = found->dir, last = a->dirs[dir].last;
+    int i = 0, j = a->dirlink_count;
+    while(i < j) {
+        int mid = (i + j) / 2;
+        if(a->dirlinks[mid].at < dir) {
+            i = mid + 1;
+        }
+        else {
+            j = mid;
+        }
+    }
+    *lo = i;
+    j = a->dirlink_count;
+    while(i < j) {
+        int mid = (i + j) / 2;
+        if(a->dirlinks[mid].at <= last) {
+            i = mid + 1;
+        }
+        else {
+            j = mid;
+        }
+    }
+    *hi = i;
+}
+
+// Directory links that lead back to themselves through other ones: Tarjan's strongly connected components
+static void nt_audit_loops(nt_audit_ctx *a) {
+    int n = a->dirlink_count;
+    if(n < 2) {
+        return;
+    }
+    nt_audit_id *byid = (nt_audit_id*)malloc(sizeof(nt_audit_id) * a->dir_count);
+    int *index = (int*)malloc(sizeof(int) * n * 6);
+    if(!byid || !index) {
+        free(byid);
+        free(index);
+        return;
+    }
+    int *low = index + n, *stack = low + n, *calls = stack + n, *next = calls + n, *end = next + n;
+    for(int i=0; i<a->dir_count; i++) {
+        byid[i].dev = a->dirs[i].dev;
+        byid[i].ino = a->dirs[i].ino;
+        byid[i].dir = i;
+    }
+    qsort(byid, a->dir_count, sizeof(nt_audit_id), nt_audit_by_id);
+    qsort(a->dirlinks, n, sizeof(nt_audit_dirlink), nt_audit_by_at);
+
+    for(int i=0; i<n; i++) {
+        index[i] = -1;
+    }
+    int counter = 0, top = 0;
+    for(int root=0; root<n; root++) {
+        if(index[root] >= 0) {
+            continue;
+        }
+        int depth = 0;
+        calls[depth++] = root;
+        index[root] = low[root] = counter++;
+        stack[top++] = root;
+        nt_audit_next(a, byid, &a->dirlinks[root], &next[root], &end[root]);
+        while(depth) {
+            int v = calls[depth - 1];
+            if(next[v] < end[v]) {
+                int w = next[v]++;
+                if(index[w] < 0) {
+                    index[w] = low[w] = counter++;
+                    stack[top++] = w;
+                    nt_audit_next(a, byid, &a->dirlinks[w], &next[w], &end[w]);
+                    calls[depth++] = w;
+                }
+                else if(low[w] >= 0 && index[w] < low[v]) {
+                    // Still on the stack
+                    low[v] = index[w];
+                }
+                continue;
+            }
+            -- depth;
+            if(depth && low[v] < low[calls[depth - 1]]) {
+                low[calls[depth - 1]] = low[v];
+            }
+            if(low[v] == index[v]) {
+                int first = top;
+                do {
+                    -- first;
+                } while(stack[first] != v);
+                for(int i=first; i<top; i++) {
+                    nt_audit_dirlink *l = &a->dirlinks[stack[i]];
+                    if(top - first > 1 && !l->reported) {
+                        ++ a->cycles;
+                        printf("A,c,%s,%s\n", l->path, l->target);
+                        l->reported = 1;
+                    }
+                    // Off the stack
+                    low[stack[i]] = -1;
+                }
+                top = first;
+            }
+        }
+    }
+    free(byid);
+    free(index);
+}
+
+static int nt_audit_enter(nt_audit_ctx *a, struct stat *sf) {
+    if(a->dir_count == a->dir_size) {
+        int size = a->dir_size ? a->dir_size * 2 : 64;
+        nt_audit_dir *dirs = (nt_audit_dir*)realloc(a->dirs, sizeof(nt_audit_dir) * size);
+        if(!dirs) {
+            return -1;
+        }
+        a->dirs = dirs;
+        a->dir_size = size;
+    }
+    nt_audit_dir *d = &a->dirs[a->dir_count];
+    d->dev  = sf->st_dev;
+    d->ino  = sf->st_ino;
+    d->last = a->dir_count;
+    return a->dir_count++;
+}
+
+static int nt_audit_(nt_walk_entry *e, int pass, void *ctx) {
+    nt_audit_ctx *a = (nt_audit_ctx*)ctx;
+
+    // The batch is complete once its directory is done with pass 0
+    size_t dirlen = e->name - e->path - 1;
+    if(a->count && (pass == 1 || strncmp(a->dir, e->path, dirlen) || a->dir[dirlen])) {
+        nt_audit_flush(a);
+    }
+
+    if(pass == 0) {
+        if(S_ISLNK(e->sf.st_mode)) {
+            if(!a->count) {
+                free(a->dir);
+                if(0 == (a->dir = strndup(e->path, dirlen))) {
+                    return NT_WALK_FAIL;
+                }
+                // The walker may close its own before the batch is flushed
+                a->dirfd = dup(e->dirfd);
+                a->depth = e->depth;
+            }
+            if(0 == (a->names[a->count] = strdup(e->name))) {
+                return NT_WALK_FAIL;
+            }
+            if(++ a->count == NT_AUDIT_BATCH) {
+                nt_audit_flush(a);
+            }
+        }
+    }
+    else if(S_ISDIR(e->sf.st_mode)) {
+        if(e->depth >= a->anc_size) {
+            int size = a->anc_size * 2 > e->depth + 1 ? a->anc_size * 2 : e->depth + 1;
+            int *anc = (int*)realloc(a->anc, sizeof(int) * size);
+            if(!anc) {
+                return NT_WALK_FAIL;
+            }
+            a->anc = anc;
+            a->anc_size = size;
+        }
+        if(0 > (a->anc[e->depth] = nt_audit_enter(a, &e->sf))) {
+            return NT_WALK_FAIL;
+        }
+        e->tag = a->anc[e->depth];
+        return NT_WALK_DESCEND;
+    }
+
+    return NT_WALK_CONTINUE;
+}
+
+static int nt_audit_leave_(nt_walk_entry *e, void *ctx) {
+    nt_audit_ctx *a = (nt_audit_ctx*)ctx;
+    a->dirs[e->tag].last = a->dir_count - 1;
+    return EXIT_SUCCESS;
+}
+
+int nt_link_audit(int argc, char** argv, char** env) {
+    int ret = EXIT_SUCCESS;
+    const char *root = 0;
+
+    if(argc > 2 && !strcmp(argv[1], "-r")) {
+        root = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if(argc != 2) {
+        return nt_error("Wrong # of arguments for %s: %d", __FUNCTION__, argc);
+    }
+
+    char *s = argv[1];
+    struct stat sf;
+    nt_audit_ctx *a = (nt_audit_ctx*)calloc(1, sizeof(nt_audit_ctx));
+    if(!a) {
+        return EXIT_FAILURE;
+    }
+    if(stat(s, &sf) < 0 || !realpath(root ? root : s, a->root)) {
+        free(a);
+        return nt_error("Cannot access %s", root && 0 == stat(s, &sf) ? root : s);
+    }
+    a->rootlen = strlen(a->root);
+    a->dirfd = -1;
+    a->anc = (int*)malloc(sizeof(int) * 16);
+    a->anc_size = a->anc ? 16 : 0;
+    if(!a->anc || 0 > (a->anc[0] = nt_audit_enter(a, &sf))) {
+        free(a->anc);
+        free(a);
+        return EXIT_FAILURE;
+    }
+
+    // Keep going: one unreadable directory should not hide the rest of the report
+    nt_walk_ops ops = {2, 1, nt_audit_, nt_audit_leave_, a};
+    ret = nt_walk(s, 0, 0, &ops);
+    nt_audit_flush(a);
+    a->dirs[0].last = a->dir_count - 1;
+    nt_audit_loops(a);
+    printf("T,%lld,%lld,%lld,%lld\n", a->links, a->dangling, a->escaping, a->cycles);
+
+    for(int i=0; i<a->dirlink_count; i++) {
+        free(a->dirlinks[i].path);
+        free(a->dirlinks[i].target);
+    }
+    free(a->dirlinks);
+    free(a->dirs);
+    free(a->dir);
+    free(a->anc);
+    free(a);
+
+    if(ret == EXIT_FAILURE) {
+        nt_error("Failure in function %s", __FUNCTION__);
+    }
+    return ret;
+}
\ No newline at end of file
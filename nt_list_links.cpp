@@ -28,10 +28,13 @@ int nt_list_links(int argc, char** argv, char** env) {
                 else {
                     if (S_ISLNK(sf.st_mode)) {
                         char dest[4096];
-                        if(readlink(tmp, dest, 4096) < 0) {
+                        ssize_t len = readlink(tmp, dest, sizeof(dest) - 1);
+                        if(len < 0) {
                             ret = EXIT_FAILURE;
                         }
                         else {
+                            // readlink() does not terminate the string
+                            dest[len] = '\0';
                             printf("l,%s,%s\n", entry->d_name, dest);
                         }
                     }
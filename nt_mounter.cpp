@@ -1,6 +1,8 @@
 // (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
 
 #include "nativetools.hpp"
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
 
 /*
  * For some weird reason this is dead code..?
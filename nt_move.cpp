@@ -0,0 +1,284 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+#include <sys/syscall.h>
+
+/*
+ * mv [-n] <source> <destination directory>
+ *
+ * Like cp, the source ends up as <destination directory>/<source name>.
+ * -n never replaces an existing entry (RENAME_NOREPLACE).
+ *
+ * A single rename() does it when both sides are on the same filesystem.
+ * Otherwise the tree is walked and every entry is moved on its own: it is
+ * copied, synced, checked, and its source removed right away, so the extra
+ * space needed never grows much beyond one batch of files. A file is copied
+ * under a temporary name next to its destination and only renamed over it
+ * once complete, so a failed copy never damages a file already there.
+ * Files are copied in parallel, one batch at a time, and a batch is always
+ * finished before the directory it came from is removed.
+ */
+
+#define NT_MOVE_BATCH 64
+#define NT_MOVE_NOREPLACE 1    // RENAME_NOREPLACE, from linux/fs.h
+
+typedef struct {
+    char *src;
+    char *dest;
+    struct stat sf;
+    int ret;
+} nt_move_item;
+
+typedef struct {
+    int count;
+    int failed;
+    nt_move_item items[NT_MOVE_BATCH];
+} nt_move_ctx;
+
+static int nt_rename(const char *src, const char *dest, int noreplace) {
+    if(!noreplace) {
+        return rename(src, dest);
+    }
+#if defined(SYS_renameat2)
+    if(0 == syscall(SYS_renameat2, AT_FDCWD, src, AT_FDCWD, dest, NT_MOVE_NOREPLACE)) {
+        return 0;
+    }
+    if(errno != ENOSYS && errno != EINVAL) {
+        return -1;
+    }
+#endif
+    // Old kernel or filesystem without RENAME_NOREPLACE: not atomic, but close
+    struct stat sf;
+    if(0 == lstat(dest, &sf)) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(src, dest);
+}
+
+// Copies a file, symlink or special file, makes sure it made it to disk, then removes the source
+static int nt_move_entry(char *src, char *dest, struct stat *sf) {
+    int ret = EXIT_SUCCESS;
+    unsigned long long span = NT_TRACE_BEGIN();
+
+    if(S_ISREG(sf->st_mode)) {
+        // Same directory as dest, so that rename() can put it in place
+        const char *leaf = strrchr(dest, nt_separator());
+        size_t dirlen = leaf ? leaf - dest + 1 : 0;
+        char *tmp = (char*)malloc(dirlen + sizeof(".nt-mv.XXXXXX"));
+        if(!tmp) {
+            return EXIT_FAILURE;
+        }
+        memcpy(tmp, dest, dirlen);
+        strcpy(tmp + dirlen, ".nt-mv.XXXXXX");
+        int fd = NT_IO(NT_OP_OPEN, mkstemp(tmp));
+        int created = fd >= 0;
+        if(!created) {
+            ret = EXIT_FAILURE;
+        }
+        else {
+            close(fd);
+            ret = nt_copyfile(src, tmp, sf);
+        }
+        if(ret == EXIT_SUCCESS) {
+            struct stat df;
+            fd = NT_IO(NT_OP_OPEN, open(tmp, O_RDONLY));
+            // After nt_copyfile()'s chown, which may clear set-id bits
+            if(fd < 0 || 0 != fsync(fd) || 0 != fstat(fd, &df) || df.st_size != sf->st_size
+                    || 0 != fchmod(fd, sf->st_mode & 07777) || 0 != rename(tmp, dest)) {
+                ret = EXIT_FAILURE;
+            }
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+        if(ret != EXIT_SUCCESS && created) {
+            // Leave no half-copied file behind, the source is still there
+            unlink(tmp);
+        }
+        free(tmp);
+    }
+    else if(S_ISLNK(sf->st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = NT_IO(NT_OP_READLINK, readlink(src, target, sizeof(target) - 1));
+        if(len < 0) {
+            ret = EXIT_FAILURE;
+        }
+        else {
+            target[len] = '\0';
+            if(0 != symlink(target, dest)) {
+                ret = EXIT_FAILURE;
+            }
+            else {
+                NT_IO(NT_OP_CHOWN, lchown(dest, sf->st_uid, sf->st_gid));
+            }
+        }
+    }
+    else if(0 == mknod(dest, sf->st_mode, sf->st_rdev)) {
+        NT_IO(NT_OP_CHOWN, chown(dest, sf->st_uid, sf->st_gid));
+    }
+    else {
+        ret = EXIT_FAILURE;
+    }
+
+    if(ret == EXIT_SUCCESS) {
+        struct timespec times[2] = {sf->st_atim, sf->st_mtim};
+        utimensat(AT_FDCWD, dest, times, AT_SYMLINK_NOFOLLOW);
+        nt_qos_ops(1);
+        if(0 != NT_IO(NT_OP_UNLINK, unlink(src))) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    NT_TRACE_END("move", src, span);
+    return ret;
+}
+
+static void nt_move_one(int i, void *ctx) {
+    nt_move_item *item = &((nt_move_ctx*)ctx)->items[i];
+    item->ret = nt_move_entry(item->src, item->dest, &item->sf);
+    if(item->ret != EXIT_SUCCESS) {
+        nt_error("Cannot move %s", item->src);
+    }
+}
+
+static int nt_move_flush(nt_move_ctx *m) {
+    if(m->count) {
+        nt_parallel_for(m->count, nt_cpu_count() * 2, nt_move_one, m);
+        for(int i=0; i<m->count; i++) {
+            if(m->items[i].ret != EXIT_SUCCESS) {
+                m->failed = 1;
+            }
+            free(m->items[i].src);
+            free(m->items[i].dest);
+        }
+        m->count = 0;
+    }
+    return m->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int nt_move_(nt_walk_entry *e, int pass, void *ctx) {
+    int ret = NT_WALK_CONTINUE;
+    nt_move_ctx *m = (nt_move_ctx*)ctx;
+
+    // A single pass: only entries already read are ever removed from the directory being read
+    if(!S_ISDIR(e->sf.st_mode)) {
+        // The walker reuses the entry's memory once we return
+        nt_move_item *item = &m->items[m->count];
+        item->src  = strdup(e->path);
+        item->dest = nt_arena_path(e->arena, e->parent_aux, e->name);
+        item->dest = item->dest ? strdup(item->dest) : 0;
+        item->sf   = e->sf;
+        item->ret  = EXIT_FAILURE;
+        if(!item->src || !item->dest) {
+            free(item->src);
+            free(item->dest);
+            return NT_WALK_FAIL;
+        }
+        if(++ m->count == NT_MOVE_BATCH && EXIT_SUCCESS != nt_move_flush(m)) {
+            ret = NT_WALK_FAIL;
+        }
+    }
+    else {
+        char *destpath = nt_arena_path(e->arena, e->parent_aux, e->name);
+        nt_qos_ops(2);
+        if(!destpath) {
+            ret = NT_WALK_FAIL;
+        }
+        else if(0 == NT_IO(NT_OP_MKDIR, mkdir(destpath, e->sf.st_mode)) || errno == EEXIST) {
+            NT_IO(NT_OP_CHOWN, chown(destpath, e->sf.st_uid, e->sf.st_gid));
+            e->aux = destpath;
+            ret = NT_WALK_DESCEND;
+        }
+        else {
+            ret = NT_WALK_FAIL;
+        }
+    }
+
+    return ret;
+}
+
+static int nt_move_dir_done(nt_move_ctx *m, char *src, char *dest, struct stat *sf) {
+    if(EXIT_SUCCESS != nt_move_flush(m)) {
+        return EXIT_FAILURE;
+    }
+    struct timespec times[2] = {sf->st_atim, sf->st_mtim};
+    utimensat(AT_FDCWD, dest, times, 0);
+    nt_qos_ops(1);
+    return 0 == NT_IO(NT_OP_RMDIR, rmdir(src)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int nt_move_leave_(nt_walk_entry *e, void *ctx) {
+    return nt_move_dir_done((nt_move_ctx*)ctx, e->path, e->aux, &e->sf);
+}
+
+// Across filesystems
+static int nt_move_tree(char *s, char *destpath, struct stat *sf, int noreplace) {
+    struct stat df;
+    if(noreplace && 0 == lstat(destpath, &df)) {
+        errno = EEXIST;
+        return EXIT_FAILURE;
+    }
+    if(!S_ISDIR(sf->st_mode)) {
+        return nt_move_entry(s, destpath, sf);
+    }
+    if(0 != mkdir(destpath, sf->st_mode) && errno != EEXIST) {
+        return EXIT_FAILURE;
+    }
+    chown(destpath, sf->st_uid, sf->st_gid);
+
+    nt_move_ctx *m = (nt_move_ctx*)malloc(sizeof(nt_move_ctx));
+    if(!m) {
+        return EXIT_FAILURE;
+    }
+    m->count     = 0;
+    m->failed    = 0;
+    nt_walk_ops ops = {1, 0, nt_move_, nt_move_leave_, m};
+    int ret = nt_walk(s, destpath, 0, &ops);
+    // Whatever the walk did, files already queued are moved or left alone, never lost
+    if(EXIT_SUCCESS != nt_move_dir_done(m, s, destpath, sf)) {
+        ret = EXIT_FAILURE;
+    }
+    free(m);
+    return ret;
+}
+
+int nt_move(int argc, char** argv, char** env) {
+    int ret = EXIT_SUCCESS;
+    int noreplace = 0;
+
+    if(argc > 1 && !strcmp(argv[1], "-n")) {
+        noreplace = 1;
+        -- argc;
+        ++ argv;
+    }
+    if(argc != 3) {
+        ret = nt_error("Wrong # of arguments for %s: %d", __FUNCTION__, argc);
+    }
+    else {
+        char *s    = argv[1];
+        char *dest = argv[2];
+        char destpath[PATH_MAX];
+        struct stat sf;
+
+        // "dir/" would otherwise be renamed onto the destination directory itself
+        size_t len = strlen(s);
+        while(len > 1 && s[len - 1] == nt_separator()) {
+            s[-- len] = '\0';
+        }
+        if(lstat(s, &sf) < 0) {
+            ret = EXIT_FAILURE;
+        }
+        else if(snprintf(destpath, sizeof(destpath), "%s%c%s", dest, nt_separator(), nt_basename(s)) >= (int)sizeof(destpath)) {
+            ret = EXIT_FAILURE;
+        }
+        else if(0 != nt_rename(s, destpath, noreplace)) {
+            ret = errno == EXDEV ? nt_move_tree(s, destpath, &sf, noreplace) : EXIT_FAILURE;
+        }
+
+        if(ret == EXIT_FAILURE) {
+            nt_error("Failure in function %s", __FUNCTION__);
+        }
+    }
+    return ret;
+}
\ No newline at end of file
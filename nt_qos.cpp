@@ -0,0 +1,89 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+#include <time.h>
+#include <sys/syscall.h>
+
+/*
+ * I/O QoS for long background jobs: --qos sets the I/O scheduling class,
+ * --max-bps and --max-ops cap data bytes and metadata operations per second.
+ *
+ * The idle class only gets disk time when nobody else wants it, so a big
+ * cp started with --qos=idle runs at full speed on a quiet device and backs
+ * off as soon as the foreground app does I/O. The rate caps are token
+ * buckets shared by all threads; a caller that overdraws its bucket sleeps
+ * until the debt has been paid back, which keeps the average rate exact
+ * even with large requests.
+ */
+
+// From linux/ioprio.h, which older NDKs do not ship
+#define NT_IOPRIO_WHO_PROCESS 1
+#define NT_IOPRIO_CLASS_SHIFT 13
+
+typedef struct {
+    pthread_mutex_t lock;
+    double tokens;
+    unsigned long long last;
+} nt_qos_bucket;
+
+static nt_qos_bucket nt_qos_byte_bucket = {PTHREAD_MUTEX_INITIALIZER, 0, 0};
+static nt_qos_bucket nt_qos_op_bucket   = {PTHREAD_MUTEX_INITIALIZER, 0, 0};
+
+static unsigned long long nt_qos_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int nt_qos_apply() {
+    if(work_ioprio_class == NT_IOPRIO_CLASS_NONE) {
+        return EXIT_SUCCESS;
+    }
+#if defined(__NR_ioprio_set)
+    // Threads started later inherit it
+    int prio = (work_ioprio_class << NT_IOPRIO_CLASS_SHIFT) | work_ioprio_level;
+    if(0 == syscall(__NR_ioprio_set, NT_IOPRIO_WHO_PROCESS, 0, prio)) {
+        return EXIT_SUCCESS;
+    }
+#endif
+    return nt_error("Cannot set I/O priority");
+}
+
+static void nt_qos_take(nt_qos_bucket *b, long long rate, long long amount) {
+    pthread_mutex_lock(&b->lock);
+    unsigned long long now = nt_qos_now();
+    if(!b->last) {
+        b->tokens = (double)rate / 10;
+    }
+    else {
+        b->tokens += (double)(now - b->last) * rate / 1e9;
+    }
+    // Do not let an idle spell turn into a long burst: a tenth of a second at most
+    if(b->tokens > (double)rate / 10) {
+        b->tokens = (double)rate / 10;
+    }
+    b->last = now;
+    b->tokens -= amount;
+    double debt = -b->tokens;
+    pthread_mutex_unlock(&b->lock);
+
+    if(debt > 0) {
+        unsigned long long wait = (unsigned long long)(debt * 1e9 / rate);
+        struct timespec ts;
+        ts.tv_sec  = wait / 1000000000ULL;
+        ts.tv_nsec = wait % 1000000000ULL;
+        while(0 != nanosleep(&ts, &ts) && errno == EINTR) {}
+    }
+}
+
+void nt_qos_bytes(long long count) {
+    if(work_max_bps > 0 && count > 0) {
+        nt_qos_take(&nt_qos_byte_bucket, work_max_bps, count);
+    }
+}
+
+void nt_qos_ops(long long count) {
+    if(work_max_ops > 0 && count > 0) {
+        nt_qos_take(&nt_qos_op_bucket, work_max_ops, count);
+    }
+}
\ No newline at end of file
@@ -6,7 +6,8 @@ int nt_recursive_chown_(char *path, int parentindex, struct stat *sf) {
     int ret = EXIT_SUCCESS;
     if(parentindex){}; // This function does not care about parentindex
     if(sf){}; // This function does not use isdir
-    if(0 != lchown(path, work_uid, work_uid)) {
+    nt_qos_ops(1);
+    if(0 != NT_IO(NT_OP_CHOWN, lchown(path, work_uid, work_uid))) {
         ret = EXIT_FAILURE;
     }
     return ret;
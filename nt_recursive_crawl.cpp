@@ -6,7 +6,7 @@ int nt_recursive_crawl_(char *path, int parentindex, struct stat *sf) {
     int ret = EXIT_SUCCESS;
     char f_type = S_ISLNK(sf->st_mode) ? 'l' : S_ISDIR(sf->st_mode) ? 'd' : 'f';
     char f_exec = f_type != 'l' && sf->st_mode & S_IXUSR ? 'x' : '-';
-    printf("%u,%u,%c,%c,%lld,%lld,%s\n", work_index, parentindex, f_type, f_exec, sf->st_size, sf->st_blocks, path);
+    printf("%u,%u,%c,%c,%lld,%lld,%s\n", work_index, parentindex, f_type, f_exec, (long long)sf->st_size, (long long)sf->st_blocks, path);
 	if(ret==EXIT_FAILURE) {nt_error("%s:#1", __FUNCTION__);}
     return ret;
 }
@@ -0,0 +1,161 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+
+#if !defined(NT_NO_STATS)
+#include <time.h>
+
+/*
+ * --stats: counts and times the I/O calls wrapped in NT_IO().
+ *
+ * Each thread accumulates into its own block, so there is no contention;
+ * blocks are chained together when first created and only summed up when
+ * the report is printed, once the applet is done.
+ * Latencies go in power of two buckets: bucket i counts calls that took
+ * [2^i, 2^(i+1)) nanoseconds.
+ */
+
+#define NT_STATS_BUCKETS 36
+
+typedef struct nt_stats_block {
+    struct nt_stats_block *next;
+    unsigned long long calls[NT_OP_COUNT];
+    unsigned long long total_ns[NT_OP_COUNT];
+    unsigned long long max_ns[NT_OP_COUNT];
+    unsigned long long bytes[NT_OP_COUNT];
+    unsigned long long hist[NT_OP_COUNT][NT_STATS_BUCKETS];
+} nt_stats_block;
+
+static const char *nt_stats_names[NT_OP_COUNT] = {
+    "opendir", "readdir", "lstat", "readlink", "open", "read", "write", "chown", "unlink", "mkdir", "rmdir"
+};
+
+static pthread_key_t nt_stats_key;
+static pthread_once_t nt_stats_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t nt_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static nt_stats_block *nt_stats_blocks = 0;
+
+static void nt_stats_init() {
+    pthread_key_create(&nt_stats_key, 0);
+}
+
+static nt_stats_block *nt_stats_self() {
+    pthread_once(&nt_stats_once, nt_stats_init);
+    nt_stats_block *b = (nt_stats_block*)pthread_getspecific(nt_stats_key);
+    if(!b) {
+        // Never freed: the report may be printed after this thread is gone
+        b = (nt_stats_block*)calloc(1, sizeof(nt_stats_block));
+        if(!b) {
+            return 0;
+        }
+        pthread_setspecific(nt_stats_key, b);
+        pthread_mutex_lock(&nt_stats_lock);
+        b->next = nt_stats_blocks;
+        nt_stats_blocks = b;
+        pthread_mutex_unlock(&nt_stats_lock);
+    }
+    return b;
+}
+
+static unsigned long long nt_stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 0 when --stats is off, which nt_stats_end() takes as "nothing to record"
+unsigned long long nt_stats_begin() {
+    return work_stats ? nt_stats_now() : 0;
+}
+
+void nt_stats_end(int op, unsigned long long start) {
+    if(!start) {
+        return;
+    }
+    int saved_errno = errno;
+    unsigned long long elapsed = nt_stats_now() - start;
+    nt_stats_block *b = nt_stats_self();
+    if(!b) {
+        // Out of memory: this call goes unrecorded
+        errno = saved_errno;
+        return;
+    }
+    int bucket = 0;
+    while(bucket < NT_STATS_BUCKETS - 1 && (elapsed >> (bucket + 1))) {
+        ++ bucket;
+    }
+    ++ b->calls[op];
+    b->total_ns[op] += elapsed;
+    if(elapsed > b->max_ns[op]) {
+        b->max_ns[op] = elapsed;
+    }
+    ++ b->hist[op][bucket];
+    errno = saved_errno;
+}
+
+void nt_stats_bytes(int op, long long count) {
+    nt_stats_block *b;
+    if(work_stats && count > 0 && 0 != (b = nt_stats_self())) {
+        b->bytes[op] += count;
+    }
+}
+
+static void nt_stats_duration(char *buf, size_t size, unsigned long long ns) {
+    if(ns < 1000ULL) {
+        snprintf(buf, size, "%lluns", ns);
+    }
+    else if(ns < 1000000ULL) {
+        snprintf(buf, size, "%lluus", ns / 1000ULL);
+    }
+    else if(ns < 1000000000ULL) {
+        snprintf(buf, size, "%llums", ns / 1000000ULL);
+    }
+    else {
+        snprintf(buf, size, "%llus", ns / 1000000000ULL);
+    }
+}
+
+/*
+ * One line per call type that was made, on stderr:
+ * ~STAT-op,calls,total_us,max_us,bytes,<upper bound>:<count> ...
+ */
+void nt_stats_report() {
+    nt_stats_block sum;
+    memset(&sum, 0, sizeof(sum));
+
+    pthread_mutex_lock(&nt_stats_lock);
+    for(nt_stats_block *b = nt_stats_blocks; b; b = b->next) {
+        for(int op=0; op<NT_OP_COUNT; op++) {
+            sum.calls[op]    += b->calls[op];
+            sum.total_ns[op] += b->total_ns[op];
+            sum.bytes[op]    += b->bytes[op];
+            if(b->max_ns[op] > sum.max_ns[op]) {
+                sum.max_ns[op] = b->max_ns[op];
+            }
+            for(int i=0; i<NT_STATS_BUCKETS; i++) {
+                sum.hist[op][i] += b->hist[op][i];
+            }
+        }
+    }
+    pthread_mutex_unlock(&nt_stats_lock);
+
+    for(int op=0; op<NT_OP_COUNT; op++) {
+        if(!sum.calls[op]) {
+            continue;
+        }
+        fprintf(stderr, "~STAT-%s,%llu,%llu,%llu,%llu,", nt_stats_names[op], sum.calls[op],
+            sum.total_ns[op] / 1000ULL, sum.max_ns[op] / 1000ULL, sum.bytes[op]);
+        const char *sep = "";
+        for(int i=0; i<NT_STATS_BUCKETS; i++) {
+            if(sum.hist[op][i]) {
+                char bound[16];
+                nt_stats_duration(bound, sizeof(bound), 2ULL << i);
+                fprintf(stderr, "%s%s:%llu", sep, bound, sum.hist[op][i]);
+                sep = " ";
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+#endif /* NT_NO_STATS */
\ No newline at end of file
@@ -0,0 +1,1099 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+#include <sys/sysmacros.h>
+#include <zlib.h>
+
+/*
+ * tc [-z] <directory path> <archive path|->
+ * tx <archive path|-> <destination path>
+ *
+ * POSIX tar (ustar, with pax extended headers for long names, big files and
+ * large ids), streamed straight from the tree to the archive and back: no
+ * staging copy. As with cp, <directory> is stored under its own name and
+ * extracted as <destination>/<name>. Ownership, mode and mtime are kept,
+ * those of directories being restored last. Extraction never writes through
+ * a symbolic link, not even one it created itself.
+ *
+ * -z compresses the stream the way BGZF does: a series of independent gzip
+ * members holding at most NT_BGZF_DATA bytes each, with their compressed
+ * size in a "BC" extra field. Plain gzip/zcat/tar -z read it like any other
+ * .tar.gz, and since members do not depend on each other, a batch of them
+ * is compressed, and on extraction decompressed, on all cores at once.
+ * tx also reads plain tarballs and ordinary gzip streams, the latter on a
+ * single core.
+ */
+
+#define NT_TAR_BLOCK  512
+#define NT_TAR_BUF    65536
+#define NT_TAR_META   (1 << 20) // Largest pax or GNU long name header accepted
+#define NT_BGZF_DATA  65280     // Uncompressed bytes per member, so that even incompressible data fits
+#define NT_BGZF_MAX   65536     // Largest member, header and trailer included
+#define NT_BGZF_HDR   18
+#define NT_BGZF_BATCH (NT_MAX_THREADS * 2)
+
+#define NT_TAR_PLAIN 0
+#define NT_TAR_GZIP  1
+#define NT_TAR_BGZF  2
+
+typedef struct {
+    unsigned char in[NT_BGZF_MAX];
+    unsigned char out[NT_BGZF_MAX];
+    int in_len;
+    int out_len;
+    int ret;
+} nt_bgzf_block;
+
+static void nt_put32(unsigned char *p, unsigned int v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static unsigned int nt_get32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static int nt_write_all(int fd, const unsigned char *buf, size_t count) {
+    while(count > 0) {
+        ssize_t written = NT_IO(NT_OP_WRITE, write(fd, buf, count));
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return EXIT_FAILURE;
+        }
+        NT_IO_BYTES(NT_OP_WRITE, written);
+        nt_qos_bytes(written);
+        buf += written;
+        count -= written;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Short only at end of file
+static ssize_t nt_read_full(int fd, unsigned char *buf, size_t count) {
+    size_t done = 0;
+    while(done < count) {
+        ssize_t got = NT_IO(NT_OP_READ, read(fd, buf + done, count - done));
+        if(got < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(got == 0) {
+            break;
+        }
+        NT_IO_BYTES(NT_OP_READ, got);
+        done += got;
+    }
+    return done;
+}
+
+/*
+ * Compression, one gzip member per block
+ */
+
+static void nt_bgzf_deflate(int i, void *ctx) {
+    nt_bgzf_block *b = &((nt_bgzf_block*)ctx)[i];
+    static const unsigned char header[NT_BGZF_HDR - 2] = {
+        0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0
+    };
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    b->ret = EXIT_FAILURE;
+    if(Z_OK != deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)) {
+        return;
+    }
+    z.next_in   = b->in;
+    z.avail_in  = b->in_len;
+    z.next_out  = b->out + NT_BGZF_HDR;
+    z.avail_out = NT_BGZF_MAX - NT_BGZF_HDR - 8;
+    if(Z_STREAM_END == deflate(&z, Z_FINISH)) {
+        int len = NT_BGZF_HDR + z.total_out + 8;
+        memcpy(b->out, header, sizeof(header));
+        b->out[16] = (len - 1) & 0xff;
+        b->out[17] = (len - 1) >> 8;
+        nt_put32(b->out + len - 8, crc32(crc32(0, 0, 0), b->in, b->in_len));
+        nt_put32(b->out + len - 4, b->in_len);
+        b->out_len = len;
+        b->ret = EXIT_SUCCESS;
+    }
+    deflateEnd(&z);
+}
+
+static void nt_bgzf_inflate(int i, void *ctx) {
+    nt_bgzf_block *b = &((nt_bgzf_block*)ctx)[i];
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    b->ret = EXIT_FAILURE;
+    if(b->in_len < NT_BGZF_HDR + 8 || Z_OK != inflateInit2(&z, -15)) {
+        return;
+    }
+    unsigned int isize = nt_get32(b->in + b->in_len - 4);
+    z.next_in   = b->in + NT_BGZF_HDR;
+    z.avail_in  = b->in_len - NT_BGZF_HDR - 8;
+    z.next_out  = b->out;
+    z.avail_out = NT_BGZF_MAX;
+    if(Z_STREAM_END == inflate(&z, Z_FINISH) && z.total_out == isize &&
+       crc32(crc32(0, 0, 0), b->out, isize) == nt_get32(b->in + b->in_len - 8)) {
+        b->out_len = isize;
+        b->ret = EXIT_SUCCESS;
+    }
+    inflateEnd(&z);
+}
+
+/*
+ * Archive output: plain, or compressed NT_BGZF_BATCH blocks at a time
+ */
+
+typedef struct {
+    int fd;
+    int compress;
+    int failed;
+    int count;                  // Blocks full and waiting, blocks[count] is being filled
+    nt_bgzf_block *blocks;
+} nt_tar_out;
+
+static void nt_tar_out_flush(nt_tar_out *o) {
+    if(!o->compress) {
+        if(o->blocks[0].in_len && EXIT_SUCCESS != nt_write_all(o->fd, o->blocks[0].in, o->blocks[0].in_len)) {
+            o->failed = 1;
+        }
+        o->blocks[0].in_len = 0;
+        return;
+    }
+    unsigned long long span = NT_TRACE_BEGIN();
+    nt_parallel_for(o->count, nt_cpu_count(), nt_bgzf_deflate, o->blocks);
+    NT_TRACE_END("compress", 0, span);
+    for(int i=0; i<o->count; i++) {
+        if(o->blocks[i].ret != EXIT_SUCCESS || EXIT_SUCCESS != nt_write_all(o->fd, o->blocks[i].out, o->blocks[i].out_len)) {
+            o->failed = 1;
+        }
+        o->blocks[i].in_len = 0;
+    }
+    o->count = 0;
+}
+
+static void nt_tar_put(nt_tar_out *o, const void *data, size_t count) {
+    const unsigned char *p = (const unsigned char*)data;
+    int room = o->compress ? NT_BGZF_DATA : NT_BGZF_MAX;
+    while(count > 0 && !o->failed) {
+        nt_bgzf_block *b = &o->blocks[o->count];
+        size_t take = room - b->in_len;
+        if(take > count) {
+            take = count;
+        }
+        memcpy(b->in + b->in_len, p, take);
+        b->in_len += take;
+        p += take;
+        count -= take;
+        if(b->in_len == room) {
+            if(o->compress && ++ o->count < NT_BGZF_BATCH) {
+                continue;
+            }
+            nt_tar_out_flush(o);
+        }
+    }
+}
+
+static void nt_tar_pad(nt_tar_out *o, unsigned long long size) {
+    static const unsigned char zeros[NT_TAR_BLOCK] = {0};
+    if(size % NT_TAR_BLOCK) {
+        nt_tar_put(o, zeros, NT_TAR_BLOCK - size % NT_TAR_BLOCK);
+    }
+}
+
+static int nt_tar_out_close(nt_tar_out *o) {
+    static const unsigned char zeros[NT_TAR_BLOCK * 2] = {0};
+    nt_tar_put(o, zeros, sizeof(zeros));
+    if(o->compress && o->blocks[o->count].in_len) {
+        ++ o->count;
+    }
+    nt_tar_out_flush(o);
+    if(o->compress && !o->failed) {
+        // Empty last member, tells BGZF readers the archive was not truncated
+        o->blocks[0].in_len = 0;
+        o->count = 1;
+        nt_tar_out_flush(o);
+    }
+    return o->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Headers
+ */
+
+static int nt_tar_octal(char *field, int width, unsigned long long value) {
+    char tmp[24];
+    snprintf(tmp, sizeof(tmp), "%0*llo", width - 1, value);
+    if((int)strlen(tmp) > width - 1) {
+        return EXIT_FAILURE;
+    }
+    memcpy(field, tmp, width);
+    return EXIT_SUCCESS;
+}
+
+// "<length> <key>=<value>\n", the length counting itself
+static size_t nt_tar_pax_record(char *buf, size_t size, const char *key, const char *value) {
+    size_t base = strlen(key) + strlen(value) + 3;
+    size_t len = base + 1;
+    for(;;) {
+        char digits[24];
+        size_t next = base + snprintf(digits, sizeof(digits), "%zu", len);
+        if(next == len) break;
+        len = next;
+    }
+    snprintf(buf, size, "%zu %s=%s\n", len, key, value);
+    return len < size ? len : 0;
+}
+
+static void nt_tar_checksum(char *h) {
+    unsigned int sum = 0;
+    memset(h + 148, ' ', 8);
+    for(int i=0; i<NT_TAR_BLOCK; i++) {
+        sum += (unsigned char)h[i];
+    }
+    snprintf(h + 148, 8, "%06o", sum);
+    h[155] = ' ';
+}
+
+static int nt_tar_header(nt_tar_out *o, const char *name, const char *link, struct stat *sf, char type, unsigned long long size) {
+    char h[NT_TAR_BLOCK];
+    char small[NT_TAR_BLOCK * 2];
+    // Room for every record: path and linkpath add under 32 bytes to their value, the numeric ones take under 32
+    size_t pax_size = strlen(name) + strlen(link) + 256;
+    char *pax = pax_size <= sizeof(small) ? small : (char*)malloc(pax_size);
+    size_t pax_len = 0;
+    if(!pax) {
+        return nt_error("Out of memory");
+    }
+    memset(h, 0, sizeof(h));
+
+    if(strlen(name) > 100) {
+        pax_len += nt_tar_pax_record(pax + pax_len, pax_size - pax_len, "path", name);
+    }
+    if(strlen(link) > 100) {
+        pax_len += nt_tar_pax_record(pax + pax_len, pax_size - pax_len, "linkpath", link);
+    }
+    strncpy(h, name, 100);
+    strncpy(h + 157, link, 100);
+    nt_tar_octal(h + 100, 8, sf->st_mode & 07777);
+    if(EXIT_SUCCESS != nt_tar_octal(h + 108, 8, sf->st_uid)) {
+        char tmp[24];
+        snprintf(tmp, sizeof(tmp), "%u", (unsigned int)sf->st_uid);
+        pax_len += nt_tar_pax_record(pax + pax_len, pax_size - pax_len, "uid", tmp);
+    }
+    if(EXIT_SUCCESS != nt_tar_octal(h + 116, 8, sf->st_gid)) {
+        char tmp[24];
+        snprintf(tmp, sizeof(tmp), "%u", (unsigned int)sf->st_gid);
+        pax_len += nt_tar_pax_record(pax + pax_len, pax_size - pax_len, "gid", tmp);
+    }
+    if(EXIT_SUCCESS != nt_tar_octal(h + 124, 12, size)) {
+        char tmp[24];
+        snprintf(tmp, sizeof(tmp), "%llu", size);
+        pax_len += nt_tar_pax_record(pax + pax_len, pax_size - pax_len, "size", tmp);
+    }
+    nt_tar_octal(h + 136, 12, sf->st_mtime > 0 ? sf->st_mtime : 0);
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    strncpy(h + 265, nt_user_name(sf->st_uid), 31);
+    strncpy(h + 297, nt_group_name(sf->st_gid), 31);
+    if(type == '3' || type == '4') {
+        nt_tar_octal(h + 329, 8, major(sf->st_rdev));
+        nt_tar_octal(h + 337, 8, minor(sf->st_rdev));
+    }
+    nt_tar_checksum(h);
+
+    if(pax_len) {
+        char x[NT_TAR_BLOCK];
+        memcpy(x, h, sizeof(x));
+        memset(x, 0, 100);
+        memset(x + 157, 0, 100);
+        strcpy(x, "././@PaxHeader");
+        nt_tar_octal(x + 124, 12, pax_len);
+        x[156] = 'x';
+        nt_tar_checksum(x);
+        nt_tar_put(o, x, sizeof(x));
+        nt_tar_put(o, pax, pax_len);
+        nt_tar_pad(o, pax_len);
+    }
+    nt_tar_put(o, h, sizeof(h));
+    if(pax != small) {
+        free(pax);
+    }
+    return EXIT_SUCCESS;
+}
+
+// One entry: header, then contents for a regular file
+static int nt_tar_add(nt_tar_out *o, const char *path, const char *name, struct stat *sf) {
+    int ret = EXIT_SUCCESS;
+    char link[PATH_MAX] = "";
+
+    if(S_ISREG(sf->st_mode)) {
+        nt_qos_ops(1);
+        int fd = NT_IO(NT_OP_OPEN, open(path, O_RDONLY));
+        if(fd < 0) {
+            return nt_error("Cannot read %s", path);
+        }
+        unsigned long long span = NT_TRACE_BEGIN();
+        if(EXIT_SUCCESS != nt_tar_header(o, name, link, sf, '0', sf->st_size)) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        // The header promised st_size bytes: a file that changes meanwhile is cut or zero-padded
+        unsigned char buf[NT_TAR_BUF];
+        unsigned long long left = sf->st_size;
+        while(left > 0 && !o->failed) {
+            size_t want = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+            ssize_t got = nt_read_full(fd, buf, want);
+            if(got < (ssize_t)want) {
+                ret = nt_error("%s changed while being archived", path);
+                memset(buf + (got > 0 ? got : 0), 0, want - (got > 0 ? got : 0));
+            }
+            nt_tar_put(o, buf, want);
+            left -= want;
+        }
+        nt_tar_pad(o, sf->st_size);
+        close(fd);
+        NT_TRACE_END("copy", path, span);
+    }
+    else if(S_ISDIR(sf->st_mode)) {
+        size_t len = strlen(name);
+        char *dirname = (char*)malloc(len + 2);
+        if(!dirname) {
+            return nt_error("Out of memory");
+        }
+        memcpy(dirname, name, len);
+        strcpy(dirname + len, "/");
+        ret = nt_tar_header(o, dirname, link, sf, '5', 0);
+        free(dirname);
+    }
+    else if(S_ISLNK(sf->st_mode)) {
+        ssize_t len = NT_IO(NT_OP_READLINK, readlink(path, link, sizeof(link) - 1));
+        if(len < 0) {
+            return nt_error("Cannot read link %s", path);
+        }
+        link[len] = '\0';
+        ret = nt_tar_header(o, name, link, sf, '2', 0);
+    }
+    else if(S_ISCHR(sf->st_mode) || S_ISBLK(sf->st_mode) || S_ISFIFO(sf->st_mode)) {
+        ret = nt_tar_header(o, name, link, sf, S_ISCHR(sf->st_mode) ? '3' : S_ISBLK(sf->st_mode) ? '4' : '6', 0);
+    }
+    // Sockets cannot be archived, like tar we leave them out
+
+    return o->failed ? EXIT_FAILURE : ret;
+}
+
+typedef struct {
+    nt_tar_out *out;
+    const char *base;           // Name of the root in the archive
+    size_t rootlen;
+} nt_tar_ctx;
+
+static int nt_tar_create_(nt_walk_entry *e, int pass, void *ctx) {
+    nt_tar_ctx *t = (nt_tar_ctx*)ctx;
+    char *name = nt_arena_path(e->arena, t->base, e->path + t->rootlen + 1);
+    if(!name || EXIT_SUCCESS != nt_tar_add(t->out, e->path, name, &e->sf)) {
+        return NT_WALK_FAIL;
+    }
+    return S_ISDIR(e->sf.st_mode) ? NT_WALK_DESCEND : NT_WALK_CONTINUE;
+}
+
+int nt_tar_create(int argc, char** argv, char** env) {
+    int ret = EXIT_SUCCESS;
+    int compress = 0;
+
+    if(argc > 1 && !strcmp(argv[1], "-z")) {
+        compress = 1;
+        -- argc;
+        ++ argv;
+    }
+    if(argc != 3) {
+        return nt_error("Wrong # of arguments for %s: %d", __FUNCTION__, argc);
+    }
+
+    char *s = argv[1];
+    size_t len = strlen(s);
+    while(len > 1 && s[len - 1] == nt_separator()) {
+        s[-- len] = '\0';
+    }
+    struct stat sf;
+    if(lstat(s, &sf) < 0) {
+        return nt_error("Cannot access %s", s);
+    }
+
+    nt_tar_out o;
+    o.fd       = strcmp(argv[2], "-") ? open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    o.compress = compress;
+    o.failed   = 0;
+    o.count    = 0;
+    o.blocks   = (nt_bgzf_block*)malloc(sizeof(nt_bgzf_block) * (compress ? NT_BGZF_BATCH : 1));
+    if(o.fd < 0 || !o.blocks) {
+        free(o.blocks);
+        return nt_error("Cannot write to %s", argv[2]);
+    }
+    for(int i=0; i<(compress ? NT_BGZF_BATCH : 1); i++) {
+        o.blocks[i].in_len = 0;
+    }
+
+    nt_tar_ctx t = {&o, nt_basename(s), len};
+    ret = nt_tar_add(&o, s, t.base, &sf);
+    if(ret == EXIT_SUCCESS && S_ISDIR(sf.st_mode)) {
+        // Unreadable or vanishing files are reported, and the rest of the tree still archived
+        nt_walk_ops ops = {1, 1, nt_tar_create_, 0, &t};
+        ret = nt_walk(s, 0, 0, &ops);
+    }
+    if(EXIT_SUCCESS != nt_tar_out_close(&o)) {
+        ret = EXIT_FAILURE;
+    }
+    if(o.fd != STDOUT_FILENO && 0 != close(o.fd)) {
+        ret = EXIT_FAILURE;
+    }
+    free(o.blocks);
+
+    if(ret == EXIT_FAILURE) {
+        nt_error("Failure in function %s", __FUNCTION__);
+    }
+    return ret;
+}
+
+/*
+ * Archive input: plain, gzip, or BGZF decompressed NT_BGZF_BATCH members at a time
+ */
+
+typedef struct {
+    int fd;
+    int mode;
+    unsigned char peek[NT_BGZF_HDR];    // What was read to tell the format, served first
+    int peek_len;
+    int peek_pos;
+    z_stream z;
+    unsigned char zbuf[NT_TAR_BUF];
+    int count;                          // BGZF: blocks[cur].out[pos..] is next
+    int cur;
+    int pos;
+    nt_bgzf_block *blocks;
+    int broken;                         // Out of sync with the stream, nothing more can be read
+} nt_tar_in;
+
+static ssize_t nt_tar_raw(nt_tar_in *in, unsigned char *buf, size_t count) {
+    size_t done = 0;
+    while(in->peek_pos < in->peek_len && done < count) {
+        buf[done++] = in->peek[in->peek_pos++];
+    }
+    ssize_t got = nt_read_full(in->fd, buf + done, count - done);
+    return got < 0 ? -1 : (ssize_t)(done + got);
+}
+
+static int nt_bgzf_is_member(const unsigned char *h) {
+    return h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && (h[3] & 4) &&
+           h[10] == 6 && h[11] == 0 && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0;
+}
+
+static int nt_bgzf_fill(nt_tar_in *in) {
+    in->count = in->cur = in->pos = 0;
+    while(in->count < NT_BGZF_BATCH) {
+        nt_bgzf_block *b = &in->blocks[in->count];
+        ssize_t got = nt_tar_raw(in, b->in, NT_BGZF_HDR);
+        if(got == 0) {
+            break;
+        }
+        if(got != NT_BGZF_HDR || !nt_bgzf_is_member(b->in)) {
+            return nt_error("Not a block-compressed archive");
+        }
+        b->in_len = (b->in[16] | (b->in[17] << 8)) + 1;
+        if(b->in_len < NT_BGZF_HDR + 8 || nt_tar_raw(in, b->in + NT_BGZF_HDR, b->in_len - NT_BGZF_HDR) != b->in_len - NT_BGZF_HDR) {
+            return EXIT_FAILURE;
+        }
+        ++ in->count;
+    }
+    unsigned long long span = NT_TRACE_BEGIN();
+    nt_parallel_for(in->count, nt_cpu_count(), nt_bgzf_inflate, in->blocks);
+    NT_TRACE_END("decompress", 0, span);
+    for(int i=0; i<in->count; i++) {
+        if(in->blocks[i].ret != EXIT_SUCCESS) {
+            return nt_error("Corrupted archive");
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static int nt_tar_get_(nt_tar_in *in, void *data, size_t count) {
+    unsigned char *p = (unsigned char*)data;
+    if(in->mode == NT_TAR_PLAIN) {
+        return nt_tar_raw(in, p, count) == (ssize_t)count ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if(in->mode == NT_TAR_BGZF) {
+        while(count > 0) {
+            while(in->cur < in->count && in->pos == in->blocks[in->cur].out_len) {
+                ++ in->cur;
+                in->pos = 0;
+            }
+            if(in->cur == in->count) {
+                if(EXIT_SUCCESS != nt_bgzf_fill(in) || in->count == 0) {
+                    return EXIT_FAILURE;
+                }
+                continue;
+            }
+            nt_bgzf_block *b = &in->blocks[in->cur];
+            size_t take = b->out_len - in->pos;
+            if(take > count) {
+                take = count;
+            }
+            memcpy(p, b->out + in->pos, take);
+            in->pos += take;
+            p += take;
+            count -= take;
+        }
+        return EXIT_SUCCESS;
+    }
+    in->z.next_out  = p;
+    in->z.avail_out = count;
+    while(in->z.avail_out > 0) {
+        if(in->z.avail_in == 0) {
+            ssize_t got = NT_IO(NT_OP_READ, read(in->fd, in->zbuf, sizeof(in->zbuf)));
+            if(got < 0 && errno == EINTR) continue;
+            if(got <= 0) {
+                return EXIT_FAILURE;
+            }
+            in->z.next_in  = in->zbuf;
+            in->z.avail_in = got;
+        }
+        int zret = inflate(&in->z, Z_NO_FLUSH);
+        if(zret == Z_STREAM_END) {
+            // Concatenated members
+            inflateReset(&in->z);
+        }
+        else if(zret != Z_OK && zret != Z_BUF_ERROR) {
+            return nt_error("Corrupted archive");
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Exactly count bytes of tar stream, or failure
+static int nt_tar_get(nt_tar_in *in, void *data, size_t count) {
+    if(in->broken || EXIT_SUCCESS != nt_tar_get_(in, data, count)) {
+        in->broken = 1;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int nt_tar_open(nt_tar_in *in) {
+    in->peek_pos = 0;
+    in->peek_len = nt_read_full(in->fd, in->peek, NT_BGZF_HDR);
+    in->count = in->cur = in->pos = 0;
+    in->blocks = 0;
+    in->broken = 0;
+    memset(&in->z, 0, sizeof(in->z));
+    if(in->peek_len < 2 || in->peek[0] != 0x1f || in->peek[1] != 0x8b) {
+        in->mode = NT_TAR_PLAIN;
+    }
+    else if(in->peek_len == NT_BGZF_HDR && nt_bgzf_is_member(in->peek)) {
+        in->mode = NT_TAR_BGZF;
+        if(0 == (in->blocks = (nt_bgzf_block*)malloc(sizeof(nt_bgzf_block) * NT_BGZF_BATCH))) {
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        in->mode = NT_TAR_GZIP;
+        if(Z_OK != inflateInit2(&in->z, 15 + 16)) {
+            return EXIT_FAILURE;
+        }
+        memcpy(in->zbuf, in->peek, in->peek_len);
+        in->z.next_in  = in->zbuf;
+        in->z.avail_in = in->peek_len;
+        in->peek_len = 0;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void nt_tar_in_close(nt_tar_in *in) {
+    if(in->mode == NT_TAR_GZIP) {
+        inflateEnd(&in->z);
+    }
+    free(in->blocks);
+}
+
+/*
+ * Extraction
+ */
+
+static unsigned long long nt_tar_number(const char *field, int width) {
+    unsigned long long value = 0;
+    if((unsigned char)field[0] & 0x80) {
+        // GNU base-256, for values that do not fit in octal
+        for(int i=1; i<width; i++) {
+            value = (value << 8) | (unsigned char)field[i];
+        }
+        return value;
+    }
+    for(int i=0; i<width && field[i]; i++) {
+        if(field[i] >= '0' && field[i] <= '7') {
+            value = (value << 3) | (field[i] - '0');
+        }
+    }
+    return value;
+}
+
+static int nt_tar_skip(nt_tar_in *in, unsigned long long size) {
+    unsigned char buf[NT_TAR_BUF];
+    while(size > 0) {
+        size_t take = size < sizeof(buf) ? (size_t)size : sizeof(buf);
+        if(EXIT_SUCCESS != nt_tar_get(in, buf, take)) {
+            return EXIT_FAILURE;
+        }
+        size -= take;
+    }
+    return EXIT_SUCCESS;
+}
+
+static unsigned long long nt_tar_padded(unsigned long long size) {
+    return (size + NT_TAR_BLOCK - 1) / NT_TAR_BLOCK * NT_TAR_BLOCK;
+}
+
+// No ".." component. Symbolic links on the way are dealt with by nt_tar_parent()
+static int nt_tar_safe(const char *name) {
+    const char *p = name;
+    while(*p) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if(len == 2 && p[0] == '.' && p[1] == '.') {
+            return 0;
+        }
+        p += len;
+        while(*p == '/') ++ p;
+    }
+    return 1;
+}
+
+typedef struct {
+    int dest;                   // Destination directory
+    char dir[PATH_MAX];         // Last directory looked up, relative to dest
+    int fd;                     // Its descriptor, -1 if none
+} nt_tar_dirs;
+
+/*
+ * Descriptor on the directory an entry goes in, with *leaf pointing to its
+ * last component. The directory is opened one component at a time from the
+ * destination, creating the ones archives from other tools do not list, and
+ * never through a symbolic link: an entry cannot be written through a link
+ * the archive itself extracted earlier. Entries come grouped by directory,
+ * so the last one is kept open.
+ */
+static int nt_tar_parent(nt_tar_dirs *d, char *rel, char **leaf) {
+    char *slash = strrchr(rel, '/');
+    if(!slash) {
+        *leaf = rel;
+        return d->dest;
+    }
+    *leaf = slash + 1;
+    *slash = '\0';
+    if(d->fd < 0 || strcmp(d->dir, rel)) {
+        if(d->fd >= 0) {
+            close(d->fd);
+        }
+        d->fd = d->dest;
+        for(char *p = rel, *end; d->fd >= 0 && *p; p = end) {
+            end = strchr(p, '/');
+            end = end ? end : p + strlen(p);
+            char c = *end;
+            *end = '\0';
+            int fd = -1;
+            if(*p) {
+                fd = openat(d->fd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+                if(fd < 0 && errno == ENOENT && 0 == NT_IO(NT_OP_MKDIR, mkdirat(d->fd, p, 0755))) {
+                    fd = openat(d->fd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+                }
+            }
+            *end = c;
+            while(*end == '/') ++ end;
+            if(!*p) {
+                continue;
+            }
+            if(d->fd != d->dest) {
+                close(d->fd);
+            }
+            d->fd = fd;
+        }
+        if(d->fd == d->dest) {
+            d->fd = dup(d->dest);
+        }
+        snprintf(d->dir, sizeof(d->dir), "%s", rel);
+    }
+    *slash = '/';
+    return d->fd;
+}
+
+static void nt_tar_mtime(int dirfd, const char *name, time_t mtime) {
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    utimensat(dirfd, name, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int nt_tar_extract_file(nt_tar_in *in, int dirfd, const char *leaf, char *path, struct stat *sf, unsigned long long size) {
+    int ret = EXIT_SUCCESS;
+    int fd = -1;
+    if(dirfd >= 0) {
+        nt_qos_ops(1);
+        unlinkat(dirfd, leaf, 0);
+        // Whatever shows up in its place meanwhile is not written through
+        fd = NT_IO(NT_OP_OPEN, openat(dirfd, leaf, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, sf->st_mode & 07777));
+    }
+    if(fd < 0) {
+        ret = nt_error("Cannot create %s", path);
+    }
+    unsigned long long span = NT_TRACE_BEGIN();
+    unsigned char buf[NT_TAR_BUF];
+    unsigned long long left = nt_tar_padded(size);
+    while(left > 0) {
+        size_t take = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+        if(EXIT_SUCCESS != nt_tar_get(in, buf, take)) {
+            if(fd >= 0) close(fd);
+            return nt_error("Truncated archive");
+        }
+        left -= take;
+        // Only the padding is left once size is used up
+        size_t data = size < take ? (size_t)size : take;
+        size -= data;
+        if(fd >= 0 && ret == EXIT_SUCCESS && EXIT_SUCCESS != nt_write_all(fd, buf, data)) {
+            ret = nt_error("Cannot write %s", path);
+        }
+    }
+    if(fd >= 0) {
+        // chown() drops setuid/setgid, the mode goes last
+        NT_IO(NT_OP_CHOWN, fchown(fd, sf->st_uid, sf->st_gid));
+        fchmod(fd, sf->st_mode & 07777);
+        struct timespec times[2] = {{sf->st_mtime, 0}, {sf->st_mtime, 0}};
+        futimens(fd, times);
+        close(fd);
+    }
+    NT_TRACE_END("copy", path, span);
+    return ret;
+}
+
+typedef struct {
+    char *rel;
+    mode_t mode;
+    time_t mtime;
+} nt_tar_dir;
+
+/*
+ * Directories get their mode and mtime once everything has been
+ * extracted: a read-only directory can still be filled, and its mtime is
+ * not bumped by its own contents.
+ */
+static void nt_tar_finish_dirs(nt_tar_dirs *d, nt_tar_dir *dirs, int count) {
+    for(int i=0; i<count; i++) {
+        char *leaf;
+        int parent = nt_tar_parent(d, dirs[i].rel, &leaf);
+        int fd = parent < 0 ? -1 : openat(parent, leaf, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if(fd >= 0) {
+            fchmod(fd, dirs[i].mode);
+            struct timespec times[2] = {{dirs[i].mtime, 0}, {dirs[i].mtime, 0}};
+            futimens(fd, times);
+            close(fd);
+        }
+        free(dirs[i].rel);
+    }
+}
+
+int nt_tar_extract(int argc, char** argv, char** env) {
+    int ret = EXIT_SUCCESS;
+
+    if(argc != 3) {
+        return nt_error("Wrong # of arguments for %s: %d", __FUNCTION__, argc);
+    }
+
+    nt_tar_in in;
+    in.fd = strcmp(argv[1], "-") ? open(argv[1], O_RDONLY) : STDIN_FILENO;
+    if(in.fd < 0 || EXIT_SUCCESS != nt_tar_open(&in)) {
+        return nt_error("Cannot read %s", argv[1]);
+    }
+
+    char *dest = argv[2];
+    nt_tar_dirs dirs, links;
+    dirs.fd = links.fd = -1;
+    dirs.dest = links.dest = NT_IO(NT_OP_OPEN, open(dest, O_RDONLY | O_DIRECTORY));
+    if(dirs.dest < 0 && errno == ENOENT) {
+        for(char *p = strchr(dest + 1, '/'); p; p = strchr(p + 1, '/')) {
+            *p = '\0';
+            mkdir(dest, 0755);
+            *p = '/';
+        }
+        mkdir(dest, 0755);
+        dirs.dest = links.dest = NT_IO(NT_OP_OPEN, open(dest, O_RDONLY | O_DIRECTORY));
+    }
+    if(dirs.dest < 0) {
+        nt_tar_in_close(&in);
+        if(in.fd != STDIN_FILENO) {
+            close(in.fd);
+        }
+        return nt_error("Cannot create %s", dest);
+    }
+
+    char *longname = 0, *longlink = 0;      // From pax or GNU headers, for the next entry only
+    long long paxsize = -1, paxuid = -1, paxgid = -1;
+    long long paxmtime = 0;
+    int paxtime = 0;
+    int oversized = 0;                      // The next entry lost its metadata
+    nt_tar_dir *dirlist = 0;
+    int dircount = 0, dirsize = 0;
+    char h[NT_TAR_BLOCK];
+    char name[PATH_MAX], linkname[PATH_MAX], path[PATH_MAX * 2];
+
+    for(;;) {
+        if(EXIT_SUCCESS != nt_tar_get(&in, h, sizeof(h))) {
+            ret = nt_error("Truncated archive");
+            break;
+        }
+        int empty = 1;
+        for(int i=0; i<NT_TAR_BLOCK && empty; i++) {
+            empty = !h[i];
+        }
+        if(empty) {
+            break;
+        }
+        unsigned int sum = 0;
+        for(int i=0; i<NT_TAR_BLOCK; i++) {
+            sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)h[i];
+        }
+        if(sum != nt_tar_number(h + 148, 8)) {
+            ret = nt_error("Not a tar archive, or corrupted");
+            break;
+        }
+
+        char type = h[156];
+        unsigned long long size = paxsize >= 0 ? (unsigned long long)paxsize : nt_tar_number(h + 124, 12);
+
+        if(type == 'x' || type == 'L' || type == 'K') {
+            if(size > NT_TAR_META) {
+                // Whatever it said about the next entry cannot be trusted either
+                ret = nt_error("Metadata header of %llu bytes, skipping the entry it describes", size);
+                oversized = 1;
+                paxsize = -1;
+                if(EXIT_SUCCESS != nt_tar_skip(&in, nt_tar_padded(size))) {
+                    ret = nt_error("Truncated archive");
+                    break;
+                }
+                continue;
+            }
+            char *data = (char*)malloc(nt_tar_padded(size) + 1);
+            if(!data) {
+                ret = nt_error("Out of memory");
+                break;
+            }
+            if(EXIT_SUCCESS != nt_tar_get(&in, data, nt_tar_padded(size))) {
+                free(data);
+                ret = nt_error("Truncated archive");
+                break;
+            }
+            data[size] = '\0';
+            if(type == 'L') {
+                free(longname);
+                longname = data;
+            }
+            else if(type == 'K') {
+                free(longlink);
+                longlink = data;
+            }
+            else {
+                for(char *rec = data; rec < data + size; ) {
+                    char *key = strchr(rec, ' ');
+                    long len = strtol(rec, 0, 10);
+                    if(!key || len <= 0 || rec + len > data + size) break;
+                    char *value = strchr(key, '=');
+                    rec[len - 1] = '\0';
+                    if(value) {
+                        *value++ = '\0';
+                        if(!strcmp(key + 1, "path")) {
+                            free(longname);
+                            longname = strdup(value);
+                        }
+                        else if(!strcmp(key + 1, "linkpath")) {
+                            free(longlink);
+                            longlink = strdup(value);
+                        }
+                        else if(!strcmp(key + 1, "size")) {
+                            paxsize = strtoll(value, 0, 10);
+                        }
+                        else if(!strcmp(key + 1, "uid")) {
+                            paxuid = strtoll(value, 0, 10);
+                        }
+                        else if(!strcmp(key + 1, "gid")) {
+                            paxgid = strtoll(value, 0, 10);
+                        }
+                        else if(!strcmp(key + 1, "mtime")) {
+                            // Fractional seconds are dropped
+                            paxmtime = strtoll(value, 0, 10);
+                            paxtime = 1;
+                        }
+                    }
+                    rec += len;
+                }
+                free(data);
+            }
+            continue;
+        }
+
+        int lost = oversized;
+        oversized = 0;
+        if(longname) {
+            if(snprintf(name, sizeof(name), "%s", longname) >= (int)sizeof(name)) {
+                ret = nt_error("Name of %zu bytes too long, skipping its entry", strlen(longname));
+                lost = 1;
+            }
+        }
+        else if(h[345]) {
+            snprintf(name, sizeof(name), "%.155s/%.100s", h + 345, h);
+        }
+        else {
+            snprintf(name, sizeof(name), "%.100s", h);
+        }
+        if(longlink) {
+            if(snprintf(linkname, sizeof(linkname), "%s", longlink) >= (int)sizeof(linkname)) {
+                ret = nt_error("Link target of %zu bytes too long, skipping its entry", strlen(longlink));
+                lost = 1;
+            }
+        }
+        else {
+            snprintf(linkname, sizeof(linkname), "%.100s", h + 157);
+        }
+        struct stat sf;
+        memset(&sf, 0, sizeof(sf));
+        sf.st_mode  = nt_tar_number(h + 100, 8);
+        sf.st_uid   = paxuid >= 0 ? paxuid : nt_tar_number(h + 108, 8);
+        sf.st_gid   = paxgid >= 0 ? paxgid : nt_tar_number(h + 116, 8);
+        sf.st_mtime = paxtime ? paxmtime : nt_tar_number(h + 136, 12);
+
+        free(longname);
+        free(longlink);
+        longname = longlink = 0;
+        paxsize = paxuid = paxgid = -1;
+        paxtime = 0;
+
+        // Relative to the destination, whatever the archive says
+        char *rel = name;
+        while(*rel == '/') ++ rel;
+        size_t len = strlen(rel);
+        while(len > 0 && rel[len - 1] == '/') {
+            rel[-- len] = '\0';
+        }
+        int skip = lost || !*rel || !nt_tar_safe(rel) || (type == '1' && !nt_tar_safe(linkname));
+        if(skip || snprintf(path, sizeof(path), "%s%c%s", dest, nt_separator(), rel) >= (int)sizeof(path)) {
+            if(*rel && !lost) {
+                ret = nt_error("Skipping %s", name);
+            }
+            if(EXIT_SUCCESS != nt_tar_skip(&in, nt_tar_padded(size))) {
+                ret = nt_error("Truncated archive");
+                break;
+            }
+            continue;
+        }
+
+        if(type != '\0' && (type < '0' || type > '7')) {
+            // Global pax headers, GNU extensions...: nothing to restore
+            if(EXIT_SUCCESS != nt_tar_skip(&in, nt_tar_padded(size))) {
+                ret = nt_error("Truncated archive");
+                break;
+            }
+            continue;
+        }
+
+        char *leaf;
+        int parent = nt_tar_parent(&dirs, rel, &leaf);
+
+        if(type == '0' || type == '\0' || type == '7') {
+            if(EXIT_SUCCESS != nt_tar_extract_file(&in, parent, leaf, path, &sf, size)) {
+                ret = EXIT_FAILURE;
+                if(in.broken) {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        // Unless a parent could not be created, or is not a directory
+        int done = 0;
+        if(parent >= 0) {
+            switch(type) {
+                case '5': {
+                    nt_qos_ops(1);
+                    // Writable until nt_tar_finish_dirs() gives it its own mode
+                    if(0 == NT_IO(NT_OP_MKDIR, mkdirat(parent, leaf, (sf.st_mode & 07777) | S_IRWXU)) || errno == EEXIST) {
+                        int fd = openat(parent, leaf, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+                        if(fd >= 0) {
+                            NT_IO(NT_OP_CHOWN, fchown(fd, sf.st_uid, sf.st_gid));
+                            fchmod(fd, (sf.st_mode & 07777) | S_IRWXU);
+                            close(fd);
+                            if(dircount == dirsize) {
+                                dirsize = dirsize ? dirsize * 2 : 64;
+                                dirlist = (nt_tar_dir*)realloc(dirlist, sizeof(nt_tar_dir) * dirsize);
+                            }
+                            if(0 != (dirlist[dircount].rel = strdup(rel))) {
+                                dirlist[dircount].mode  = sf.st_mode & 07777;
+                                dirlist[dircount].mtime = sf.st_mtime;
+                                ++ dircount;
+                            }
+                            done = 1;
+                        }
+                    }
+                    break;
+                }
+                case '2':
+                    unlinkat(parent, leaf, 0);
+                    if(0 == symlinkat(linkname, parent, leaf)) {
+                        NT_IO(NT_OP_CHOWN, fchownat(parent, leaf, sf.st_uid, sf.st_gid, AT_SYMLINK_NOFOLLOW));
+                        nt_tar_mtime(parent, leaf, sf.st_mtime);
+                        done = 1;
+                    }
+                    break;
+                case '1': {
+                    char target[PATH_MAX], *tleaf;
+                    char *lrel = linkname;
+                    while(*lrel == '/') ++ lrel;
+                    snprintf(target, sizeof(target), "%s", lrel);
+                    int tparent = nt_tar_parent(&links, target, &tleaf);
+                    unlinkat(parent, leaf, 0);
+                    // A target that is a symbolic link is linked as such, not followed
+                    done = tparent >= 0 && 0 == linkat(tparent, tleaf, parent, leaf, 0);
+                    break;
+                }
+                case '3': case '4': case '6':
+                    sf.st_mode = (sf.st_mode & 07777) | (type == '3' ? S_IFCHR : type == '4' ? S_IFBLK : S_IFIFO);
+                    unlinkat(parent, leaf, 0);
+                    if(0 == mknodat(parent, leaf, sf.st_mode, makedev(nt_tar_number(h + 329, 8), nt_tar_number(h + 337, 8)))) {
+                        NT_IO(NT_OP_CHOWN, fchownat(parent, leaf, sf.st_uid, sf.st_gid, AT_SYMLINK_NOFOLLOW));
+                        nt_tar_mtime(parent, leaf, sf.st_mtime);
+                        done = 1;
+                    }
+                    break;
+            }
+        }
+        if(!done) {
+            ret = nt_error("Cannot create %s", path);
+        }
+        if(EXIT_SUCCESS != nt_tar_skip(&in, nt_tar_padded(size))) {
+            ret = nt_error("Truncated archive");
+            break;
+        }
+    }
+
+    nt_tar_finish_dirs(&dirs, dirlist, dircount);
+    free(dirlist);
+    if(dirs.fd >= 0) {
+        close(dirs.fd);
+    }
+    if(links.fd >= 0) {
+        close(links.fd);
+    }
+    close(dirs.dest);
+    free(longname);
+    free(longlink);
+    nt_tar_in_close(&in);
+    if(in.fd != STDIN_FILENO) {
+        close(in.fd);
+    }
+
+    if(ret == EXIT_FAILURE) {
+        nt_error("Failure in function %s", __FUNCTION__);
+    }
+    return ret;
+}
\ No newline at end of file
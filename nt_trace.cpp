@@ -0,0 +1,192 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+
+#if !defined(NT_NO_TRACE)
+#include <time.h>
+#include <sys/syscall.h>
+
+/*
+ * --trace=<file>: records spans (directory reads, stat batches, file copies,
+ * output flushes...) and writes them as Chrome trace-event JSON on exit, to
+ * be opened in chrome://tracing or Perfetto.
+ *
+ * Every thread writes into its own fixed-size ring, so recording takes no
+ * lock and memory stays bounded however long the run: once a ring is full,
+ * its oldest spans are overwritten. nt_parallel_for() starts new threads for
+ * every batch, so a thread that exits hands its ring over to the next one,
+ * which appends to it: there are never more rings than threads alive at
+ * once. Rings are only read by nt_trace_write(), after all worker threads
+ * have been joined.
+ */
+
+#define NT_TRACE_EVENTS 16384   // Per thread
+#define NT_TRACE_DETAIL 48
+
+typedef struct {
+    const char *name;
+    long tid;                   // Rings outlive their threads
+    unsigned long long start;
+    unsigned long long duration;
+    char detail[NT_TRACE_DETAIL];
+} nt_trace_event;
+
+typedef struct nt_trace_ring {
+    struct nt_trace_ring *next;
+    struct nt_trace_ring *next_free;
+    long tid;                   // Of the thread writing to it
+    unsigned long long head;    // Events ever recorded, head % NT_TRACE_EVENTS is the next slot
+    nt_trace_event events[NT_TRACE_EVENTS];
+} nt_trace_ring;
+
+static pthread_key_t nt_trace_key;
+static pthread_once_t nt_trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t nt_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static nt_trace_ring *nt_trace_rings = 0;
+static nt_trace_ring *nt_trace_free = 0;     // Left by threads that exited
+static unsigned long long nt_trace_epoch = 0;
+
+static void nt_trace_release(void *ring) {
+    nt_trace_ring *r = (nt_trace_ring*)ring;
+    pthread_mutex_lock(&nt_trace_lock);
+    r->next_free = nt_trace_free;
+    nt_trace_free = r;
+    pthread_mutex_unlock(&nt_trace_lock);
+}
+
+static void nt_trace_init() {
+    pthread_key_create(&nt_trace_key, nt_trace_release);
+}
+
+static unsigned long long nt_trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static nt_trace_ring *nt_trace_self() {
+    pthread_once(&nt_trace_once, nt_trace_init);
+    nt_trace_ring *r = (nt_trace_ring*)pthread_getspecific(nt_trace_key);
+    if(!r) {
+        pthread_mutex_lock(&nt_trace_lock);
+        if(nt_trace_free) {
+            r = nt_trace_free;
+            nt_trace_free = r->next_free;
+        }
+        else if(0 != (r = (nt_trace_ring*)malloc(sizeof(nt_trace_ring)))) {
+            r->head = 0;
+            r->next = nt_trace_rings;
+            nt_trace_rings = r;
+        }
+        pthread_mutex_unlock(&nt_trace_lock);
+        if(!r) {
+            return 0;
+        }
+        r->tid = (long)syscall(SYS_gettid);
+        pthread_setspecific(nt_trace_key, r);
+    }
+    return r;
+}
+
+void nt_trace_enable() {
+    nt_trace_epoch = nt_trace_now();
+}
+
+// 0 when --trace is off, which nt_trace_end() takes as "nothing to record"
+unsigned long long nt_trace_begin() {
+    return work_trace ? nt_trace_now() : 0;
+}
+
+void nt_trace_end(const char *name, const char *detail, unsigned long long start) {
+    if(!start) {
+        return;
+    }
+    int saved_errno = errno;
+    nt_trace_ring *r = nt_trace_self();
+    if(r) {
+        nt_trace_event *ev = &r->events[r->head % NT_TRACE_EVENTS];
+        ev->name     = name;
+        ev->tid      = r->tid;
+        ev->start    = start;
+        ev->duration = nt_trace_now() - start;
+        ev->detail[0] = '\0';
+        if(detail) {
+            // The end of a path says more than its beginning
+            size_t len = strlen(detail);
+            if(len >= NT_TRACE_DETAIL) {
+                detail += len - (NT_TRACE_DETAIL - 1);
+                // Not in the middle of a UTF-8 sequence
+                while((*detail & 0xc0) == 0x80) {
+                    ++ detail;
+                }
+            }
+            strcpy(ev->detail, detail);
+        }
+        ++ r->head;
+    }
+    errno = saved_errno;
+}
+
+void nt_trace_flush(FILE *f) {
+    unsigned long long start = nt_trace_begin();
+    fflush(f);
+    nt_trace_end("flush", 0, start);
+}
+
+static void nt_trace_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for(; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if(c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        }
+        else if(c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        }
+        else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+int nt_trace_write(const char *path) {
+    FILE *out = fopen(path, "w");
+    if(!out) {
+        return nt_error("Cannot write trace to %s", path);
+    }
+    int pid = (int)getpid();
+    const char *sep = "";
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&nt_trace_lock);
+    for(nt_trace_ring *r = nt_trace_rings; r; r = r->next) {
+        long tid = 0;
+        unsigned long long first = r->head > NT_TRACE_EVENTS ? r->head - NT_TRACE_EVENTS : 0;
+        for(unsigned long long i=first; i<r->head; i++) {
+            nt_trace_event *ev = &r->events[i % NT_TRACE_EVENTS];
+            // Each thread that wrote to this ring gets named as its events start
+            if(ev->tid != tid) {
+                tid = ev->tid;
+                fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                    sep, pid, tid, tid == pid ? "main" : "worker");
+                sep = ",\n";
+            }
+            fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"nativetools\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f",
+                sep, ev->name, pid, ev->tid,
+                (ev->start - nt_trace_epoch) / 1000.0, ev->duration / 1000.0);
+            if(ev->detail[0]) {
+                fprintf(out, ",\"args\":{\"detail\":");
+                nt_trace_json_string(out, ev->detail);
+                fprintf(out, "}");
+            }
+            fprintf(out, "}");
+        }
+    }
+    pthread_mutex_unlock(&nt_trace_lock);
+
+    fprintf(out, "\n]}\n");
+    return 0 == fclose(out) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif /* NT_NO_TRACE */
\ No newline at end of file
@@ -22,7 +22,7 @@ char nt_separator() {
 }
 
 char *nt_basename(const char* name) {
-	char *basename = strrchr(name, nt_separator());
+	char *basename = strrchr((char*)name, nt_separator());
 	if(basename) {
 		++basename;
 	}
@@ -32,75 +32,144 @@ char *nt_basename(const char* name) {
 	return basename;
 }
 
-int nt_listdir(const char* s) {
-    int ret = EXIT_SUCCESS;
-
-    char tmp[4096];
-    struct stat sf;
+static int nt_listdir_(nt_walk_entry *e, int pass, void *ctx) {
+    int ret = NT_WALK_CONTINUE;
+    if(ctx){}; // This function does not need a context
 
-    DIR *d;
-    if(0 == (d  = opendir(s))) {
-        ret = EXIT_FAILURE;
-    }
-    else {
-        struct dirent *entry;
-        while(0 != (entry = readdir(d))) {
-            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-            snprintf(tmp, sizeof(tmp), "%s/%s", s, entry->d_name);
-            if(lstat(tmp, &sf) < 0) {
-                ret = EXIT_FAILURE;
-                // TODO: Break or not?
+    if(pass == 0) {
+        char f_type = S_ISLNK(e->sf.st_mode) ? 'l' : S_ISDIR(e->sf.st_mode) ? 'd' : 'f';
+        char f_exec = f_type != 'l' && e->sf.st_mode & S_IXUSR ? 'x' : '-';
+        if(f_type == 'l') {
+            char dest[4096];
+            ssize_t len = NT_IO(NT_OP_READLINK, readlinkat(e->dirfd, e->name, dest, sizeof(dest) - 1));
+            if(len < 0) {
+                ret = NT_WALK_FAIL;
             }
             else {
-                char f_type = S_ISLNK(sf.st_mode) ? 'l' : S_ISDIR(sf.st_mode) ? 'd' : 'f';
-                char f_exec = f_type != 'l' && sf.st_mode & S_IXUSR ? 'x' : '-';
-                if(f_type == 'l') {
-                    char dest[4096];
-                    if(readlink(tmp, dest, 4096) < 0) {
-                        ret = EXIT_FAILURE;
-                    }
-                    else {
-                        if(strstr(dest, "/asec/") ||
-                           strstr(dest, "/openfeint/")) {
-                            f_type = 'L';
-                        }
-                    }
+                dest[len] = '\0';
+                if(strstr(dest, "/asec/") ||
+                   strstr(dest, "/openfeint/")) {
+                    f_type = 'L';
                 }
-                printf("%c,%c,%lld,%lld,%s\n", f_type, f_exec, sf.st_size, sf.st_blocks, entry->d_name);
             }
         }
-        rewinddir(d);
-        while(0 != (entry = readdir(d))) {
-            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-            snprintf(tmp, sizeof(tmp), "%s/%s", s, entry->d_name);
-                if(lstat(tmp, &sf) < 0) {
-                    ret = EXIT_FAILURE;
-                    // TODO: Break or not?
-                }
-                else {
-                    if (S_ISDIR(sf.st_mode)) {
-                        printf("%s:\n", tmp);
-                        nt_listdir(tmp);
-                    }
-                }
-        }
-        closedir(d);
+        printf("%c,%c,%lld,%lld,%s\n", f_type, f_exec, (long long)e->sf.st_size, (long long)e->sf.st_blocks, e->name);
+    }
+    else if (S_ISDIR(e->sf.st_mode)) {
+        printf("%s:\n", e->path);
+        ret = NT_WALK_DESCEND;
     }
 
     return ret;
 }
 
+int nt_listdir(const char* s) {
+    nt_walk_ops ops = {2, 1, nt_listdir_, 0, 0};
+    return nt_walk((char*)s, 0, 0, &ops);
+}
+
+/*
+ * Bump allocator for short-lived strings and records. Memory is handed out
+ * from big blocks and given back in LIFO order by releasing to a mark taken
+ * earlier, e.g. when done with a directory. The last block released is kept
+ * around so that allocating right at a block boundary does not turn into a
+ * malloc/free per call.
+ */
+struct nt_arena_block {
+    nt_arena_block *prev;
+    size_t size;
+    size_t used;
+};
+
+#define NT_ARENA_ALIGN(n) (((n) + 15) & ~(size_t)15)
+#define NT_ARENA_DATA(b) ((char*)(b) + NT_ARENA_ALIGN(sizeof(nt_arena_block)))
+
+void *nt_arena_alloc(nt_arena *a, size_t size) {
+    size = NT_ARENA_ALIGN(size);
+    nt_arena_block *b = a->top;
+    if(!b || b->used + size > b->size) {
+        if(a->spare && a->spare->size >= size) {
+            b = a->spare;
+            a->spare = 0;
+        }
+        else {
+            size_t bsize = size > NT_ARENA_BLOCK ? size : NT_ARENA_BLOCK;
+            b = (nt_arena_block*)malloc(NT_ARENA_ALIGN(sizeof(nt_arena_block)) + bsize);
+            if(!b) {
+                return 0;
+            }
+            b->size = bsize;
+        }
+        b->used = 0;
+        b->prev = a->top;
+        a->top = b;
+    }
+    void *ptr = NT_ARENA_DATA(b) + b->used;
+    b->used += size;
+    return ptr;
+}
+
+char *nt_arena_path(nt_arena *a, const char *dir, const char *name) {
+    size_t dirlen = strlen(dir), namelen = strlen(name);
+    char *path = (char*)nt_arena_alloc(a, dirlen + namelen + 2);
+    if(!path) {
+        return 0;
+    }
+    memcpy(path, dir, dirlen);
+    path[dirlen] = nt_separator();
+    memcpy(path + dirlen + 1, name, namelen + 1);
+    return path;
+}
+
+nt_arena_mark nt_arena_save(nt_arena *a) {
+    nt_arena_mark mark;
+    mark.block = a->top;
+    mark.used  = a->top ? a->top->used : 0;
+    return mark;
+}
+
+void nt_arena_release(nt_arena *a, nt_arena_mark mark) {
+    while(a->top != mark.block) {
+        nt_arena_block *b = a->top;
+        a->top = b->prev;
+        if(!a->spare || a->spare->size < b->size) {
+            free(a->spare);
+            a->spare = b;
+        }
+        else {
+            free(b);
+        }
+    }
+    if(a->top) {
+        a->top->used = mark.used;
+    }
+}
+
+void nt_arena_free(nt_arena *a) {
+    nt_arena_mark empty = {0, 0};
+    nt_arena_release(a, empty);
+    free(a->spare);
+    a->spare = 0;
+}
+
 int nt_cpfile(char* s, char* dest, char* filename, struct stat* sf) {
-    int ret = EXIT_SUCCESS;
+    char srcpath[PATH_MAX], destpath[PATH_MAX];
+    if(snprintf(srcpath, sizeof(srcpath), "%s%c%s", s, nt_separator(), filename) >= (int)sizeof(srcpath) ||
+       snprintf(destpath, sizeof(destpath), "%s%c%s", dest, nt_separator(), filename) >= (int)sizeof(destpath)) {
+        errno = ENAMETOOLONG;
+        return EXIT_FAILURE;
+    }
+    return nt_copyfile(srcpath, destpath, sf);
+}
 
-    char *srcpath = (char*)malloc(sizeof(char) * (strlen(s) + strlen(filename) + 2));
-    snprintf(srcpath, sizeof(char)*(strlen(s) + strlen(filename) + 2), "%s%c%s", s, nt_separator(), filename);
-    char *destpath = (char*)malloc(sizeof(char) * (strlen(dest) + strlen(filename) + 2));
-    snprintf(destpath, sizeof(char)*(strlen(dest) + strlen(filename) + 2), "%s%c%s", dest, nt_separator(), filename);
+int nt_copyfile(char* srcpath, char* destpath, struct stat* sf) {
+    int ret = EXIT_SUCCESS;
+    unsigned long long span = NT_TRACE_BEGIN();
 
-    int src_fd = open(srcpath, O_RDONLY);
+    nt_qos_ops(2);
+    int src_fd = NT_IO(NT_OP_OPEN, open(srcpath, O_RDONLY));
     if(-1 < src_fd) {
-        int dest_fd = open(destpath, O_WRONLY | O_CREAT | O_TRUNC, sf->st_mode);
+        int dest_fd = NT_IO(NT_OP_OPEN, open(destpath, O_WRONLY | O_CREAT | O_TRUNC, sf->st_mode));
         if(-1 < dest_fd) {
             char buf[4096], *bufptr; // aligned on 4 bytes -- 8 if needed.
             int bufsize = sizeof(buf);
@@ -109,16 +178,19 @@ int nt_cpfile(char* s, char* dest, char* filename, struct stat* sf) {
             int writecount = 0;
             do {
                 do {
-                    readcount = read(src_fd, buf, bufsize);
+                    readcount = NT_IO(NT_OP_READ, read(src_fd, buf, bufsize));
                 } while(0 > readcount && errno == EINTR);
                 if(0 < readcount) {
+                    NT_IO_BYTES(NT_OP_READ, readcount);
                     bufptr = buf;
                     remcount = readcount;
                     do {
                         do {
-                            writecount = write(dest_fd, bufptr, remcount);
+                            writecount = NT_IO(NT_OP_WRITE, write(dest_fd, bufptr, remcount));
                         } while(0 > writecount && errno == EINTR);
                         if(0 < writecount) {
+                            NT_IO_BYTES(NT_OP_WRITE, writecount);
+                            nt_qos_bytes(writecount);
                             bufptr += writecount;
                             remcount -= writecount;
                         }
@@ -145,193 +217,284 @@ int nt_cpfile(char* s, char* dest, char* filename, struct stat* sf) {
     }
 
     if(ret != EXIT_FAILURE) {
-        chown(destpath, sf->st_uid, sf->st_gid);
+        NT_IO(NT_OP_CHOWN, chown(destpath, sf->st_uid, sf->st_gid));
     }
 
-    free(destpath);
-    free(srcpath);
+    NT_TRACE_END("copy", srcpath, span);
+    return ret;
+}
+
+static int nt_cpdir_(nt_walk_entry *e, int pass, void *ctx) {
+    int ret = NT_WALK_CONTINUE;
+    if(ctx){}; // This function does not need a context
+
+    if(pass == 0) {
+        if(!S_ISDIR(e->sf.st_mode)) {
+            char *destpath = nt_arena_path(e->arena, e->parent_aux, e->name);
+            if(!destpath || EXIT_SUCCESS != nt_copyfile(e->path, destpath, &e->sf)) {
+                ret = NT_WALK_FAIL;
+            }
+        }
+    }
+    else if (S_ISDIR(e->sf.st_mode)) {
+        char *destpath = nt_arena_path(e->arena, e->parent_aux, e->name);
+        nt_qos_ops(2);
+        if(!destpath) {
+            ret = NT_WALK_FAIL;
+        }
+        else if(0 == NT_IO(NT_OP_MKDIR, mkdir(destpath, e->sf.st_mode)) || errno == EEXIST) {
+            NT_IO(NT_OP_CHOWN, chown(destpath, e->sf.st_uid, e->sf.st_gid));
+            e->aux = destpath;
+            ret = NT_WALK_DESCEND;
+        }
+        else {
+            ret = NT_WALK_FAIL;
+        }
+    }
 
     return ret;
 }
 
 int nt_cpdir(char* s, char* dest) {
-    int ret = EXIT_SUCCESS;
+    nt_walk_ops ops = {2, 0, nt_cpdir_, 0, 0};
+    return nt_walk(s, dest, 0, &ops);
+}
 
-    struct stat sf;
+static int nt_rmdir_(nt_walk_entry *e, int pass, void *ctx) {
+    int ret = NT_WALK_CONTINUE;
+    if(ctx){}; // This function does not need a context
 
-    DIR *d;
-    if(0 == (d  = opendir(s))) {
-        ret = EXIT_FAILURE;
-    }
-    else {
-        struct dirent *entry;
-        while(ret != EXIT_FAILURE && 0 != (entry = readdir(d))) {
-            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-            char *srcpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(s) + 2));
-            snprintf(srcpath, sizeof(char)*(strlen(entry->d_name) + strlen(s) + 2), "%s%c%s", s, nt_separator(), entry->d_name);
-            if(lstat(srcpath, &sf) < 0) {
-                ret = EXIT_FAILURE;
-                // TODO: Break or not?
-            }
-            else {
-                if(!S_ISDIR(sf.st_mode)) {
-                    ret = nt_cpfile(s, dest, entry->d_name, &sf);
-                }
-            }
-            free(srcpath);
+    if(pass == 0) {
+        if (S_ISDIR(e->sf.st_mode)) {
+            ret = NT_WALK_DESCEND;
         }
-        if(ret != EXIT_FAILURE) {
-            rewinddir(d);
-            while(ret != EXIT_FAILURE && 0 != (entry = readdir(d))) {
-                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-                char *srcpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(s) + 2));
-                snprintf(srcpath, sizeof(char)*(strlen(entry->d_name) + strlen(s) + 2), "%s%c%s", s, nt_separator(), entry->d_name);
-                // Be sure to always use lstat ot we may end up in hairy situations
-                if(lstat(srcpath, &sf) < 0) {
-                    ret = EXIT_FAILURE;
-                }
-                else {
-                    if (S_ISDIR(sf.st_mode)) {
-                        char *destpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(dest) + 2));
-                        snprintf(destpath, sizeof(char)*(strlen(entry->d_name) + strlen(dest) + 2), "%s%c%s", dest, nt_separator(), entry->d_name);
-                        if(0 == mkdir(destpath, sf.st_mode) || errno == EEXIST) {
-                            chown(destpath, sf.st_uid, sf.st_gid);
-                            ret = nt_cpdir(srcpath, destpath);
-                        }
-                        else {
-                            ret = EXIT_FAILURE;
-                        }
-                        free(destpath);
-                    }
-                }
-                free(srcpath);
-            }
+    }
+    else if(!S_ISDIR(e->sf.st_mode)) {
+        nt_qos_ops(1);
+        if(0 != NT_IO(NT_OP_UNLINK, unlinkat(e->dirfd, e->name, 0))) {
+            ret = NT_WALK_FAIL;
         }
-        closedir(d);
     }
 
     return ret;
 }
 
+static int nt_rmdir_leave_(nt_walk_entry *e, void *ctx) {
+    if(ctx){}; // This function does not need a context
+    nt_qos_ops(1);
+    return 0 == NT_IO(NT_OP_RMDIR, unlinkat(e->dirfd, e->name, AT_REMOVEDIR)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int nt_rmdir(char *s) {
-    int ret = EXIT_SUCCESS;
+    nt_walk_ops ops = {2, 0, nt_rmdir_, nt_rmdir_leave_, 0};
+    return nt_walk(s, 0, 0, &ops);
+}
 
-    struct stat sf;
+typedef struct {
+    int depth;
+    int (*cb)(char*, int, struct stat*);
+} nt_fileop_ctx;
 
-    DIR *d;
-    if(0 == (d  = opendir(s))) {
+// Directories are reported once their content has been, under the index they got when first seen
+static int nt_fileop_dir(nt_walk_entry *e, int my_index, nt_fileop_ctx *fo) {
+    int ret = EXIT_SUCCESS;
+    int saved_index = work_index;
+    work_index = my_index;
+    if(EXIT_SUCCESS != fo->cb(e->path, e->parent_tag, &e->sf)) {
         ret = EXIT_FAILURE;
     }
-    else {
-        struct dirent *entry;
-        while(ret != EXIT_FAILURE && 0 != (entry = readdir(d))) {
-            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-            char *subpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(s) + 2));
-            snprintf(subpath, sizeof(char)*(strlen(entry->d_name) + strlen(s) + 2), "%s%c%s", s, nt_separator(), entry->d_name);
-            if(lstat(subpath, &sf) < 0) {
-                ret = EXIT_FAILURE;
+    work_index = saved_index;
+    return ret;
+}
+
+static int nt_fileop_(nt_walk_entry *e, int pass, void *ctx) {
+    int ret = NT_WALK_CONTINUE;
+    nt_fileop_ctx *fo = (nt_fileop_ctx*)ctx;
+
+    if(pass == 0) {
+        if (S_ISDIR(e->sf.st_mode)) {
+            ++ work_index;
+            int my_index = work_index;
+            if(e->depth < fo->depth) {
+                e->tag = my_index;
+                ret = NT_WALK_DESCEND;
             }
-            else {
-                if (S_ISDIR(sf.st_mode)) {
-                    ret = nt_rmdir(subpath);
-                    if(ret != EXIT_FAILURE) {
-                        if(0 != rmdir(subpath)) {
-                            ret = EXIT_FAILURE;
-                        }
-                    }
-                }
+            else if(EXIT_SUCCESS != nt_fileop_dir(e, my_index, fo)) {
+                ret = NT_WALK_FAIL;
             }
-            free(subpath);
         }
-        if(ret != EXIT_FAILURE) {
-            rewinddir(d);
-            while(ret != EXIT_FAILURE && 0 != (entry = readdir(d))) {
-                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-                char *subpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(s) + 2));
-                snprintf(subpath, sizeof(char)*(strlen(entry->d_name) + strlen(s) + 2), "%s%c%s", s, nt_separator(), entry->d_name);
-                if(lstat(subpath, &sf) < 0) {
-                    ret = EXIT_FAILURE;
-                }
-                else {
-                    if(!S_ISDIR(sf.st_mode)) {
-                        if(0 != unlink(subpath)) {
-                            ret = EXIT_FAILURE;
-                        }
-                    }
-                }
-                free(subpath);
-            }
+    }
+    else if(!S_ISDIR(e->sf.st_mode)) {
+        ++ work_index;
+        if(0 != fo->cb(e->path, e->parent_tag, &e->sf)) {
+            ret = NT_WALK_FAIL;
         }
-        closedir(d);
     }
 
     return ret;
 }
 
+static int nt_fileop_leave_(nt_walk_entry *e, void *ctx) {
+    return nt_fileop_dir(e, e->tag, (nt_fileop_ctx*)ctx);
+}
+
 int nt_fileop(char* s, int curdepth, int parentindex, int (*cb)(char*, int, struct stat*)) {
 /* If C Compiler:
 int fileop_(char *s, int curdepth, int parentindex, int (*cb)()) {
 */
-    int ret = EXIT_SUCCESS;
+    nt_fileop_ctx fo = {curdepth, cb};
+    nt_walk_ops ops = {2, 0, nt_fileop_, nt_fileop_leave_, &fo};
+    return nt_walk(s, 0, parentindex, &ops);
+}
 
-    struct stat sf;
+/*
+ * uid/gid -> name cache. On Android, AIDs and per-app uids (u0_a123) are
+ * synthesized by bionic on every getpwuid() call, which adds up quickly
+ * when the same handful of owners is looked up for every file.
+ */
+#define NT_NAME_CACHE_SIZE 256 // Initial number of slots, must be a power of 2
 
-    DIR *d;
-    if(0 == (d  = opendir(s))) {
-        ret = EXIT_FAILURE;
+typedef struct {
+    unsigned int id;
+    char *name;
+} nt_name_entry;
+
+typedef struct {
+    nt_name_entry *slots;
+    unsigned int size;
+    unsigned int used;
+} nt_name_cache;
+
+static nt_name_cache nt_user_cache = {0, 0, 0};
+static nt_name_cache nt_group_cache = {0, 0, 0};
+static pthread_mutex_t nt_name_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static nt_name_entry *nt_name_slot(nt_name_entry *slots, unsigned int size, unsigned int id) {
+    unsigned int slot = (id * 2654435761u) & (size - 1);
+    while(slots[slot].name && slots[slot].id != id) {
+        slot = (slot + 1) & (size - 1);
     }
-    else {
-        -- curdepth;
-
-        struct dirent *entry;
-        while(ret != EXIT_FAILURE && 0 != (entry = readdir(d))) {
-            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-            char *subpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(s) + 2));
-            snprintf(subpath, sizeof(char)*(strlen(entry->d_name) + strlen(s) + 2), "%s%c%s", s, nt_separator(), entry->d_name);
-            if(lstat(subpath, &sf) < 0) {
-                ret = EXIT_FAILURE;
+    return &slots[slot];
+}
+
+// Kept at most half full, so probing stays short and always finds a free slot
+static int nt_name_grow(nt_name_cache *cache) {
+    unsigned int size = cache->size ? cache->size * 2 : NT_NAME_CACHE_SIZE;
+    nt_name_entry *slots = (nt_name_entry*)calloc(size, sizeof(nt_name_entry));
+    if(!slots) {
+        return EXIT_FAILURE;
+    }
+    for(unsigned int i=0; i<cache->size; i++) {
+        if(cache->slots[i].name) {
+            *nt_name_slot(slots, size, cache->slots[i].id) = cache->slots[i];
+        }
+    }
+    free(cache->slots);
+    cache->slots = slots;
+    cache->size = size;
+    return EXIT_SUCCESS;
+}
+
+static const char *nt_cached_name(nt_name_cache *cache, unsigned int id, int is_group) {
+    const char *ret = 0;
+    pthread_mutex_lock(&nt_name_lock);
+    if((cache->used + 1) * 2 <= cache->size || EXIT_SUCCESS == nt_name_grow(cache)) {
+        nt_name_entry *e = nt_name_slot(cache->slots, cache->size, id);
+        if(!e->name) {
+            char tmp[16];
+            const char *name = 0;
+            if(is_group) {
+                struct group *gr = getgrgid(id);
+                if(gr) name = gr->gr_name;
             }
             else {
-                if (S_ISDIR(sf.st_mode)) {
-                    ++ work_index;
-                    int my_index = work_index;
-                    if(curdepth > 0) {
-                        ret = nt_fileop(subpath, curdepth, my_index, cb);
-                    }
-                    if(ret != EXIT_FAILURE) {
-                        int saved_index = work_index;
-                        work_index = my_index;
-                        if(EXIT_SUCCESS != cb(subpath, parentindex, &sf)) {
-                            ret = EXIT_FAILURE;
-                        }
-                        work_index = saved_index;
-                    }
-                }
+                struct passwd *pw = getpwuid(id);
+                if(pw) name = pw->pw_name;
             }
-            free(subpath);
-        }
-        if(ret != EXIT_FAILURE) {
-            rewinddir(d);
-            while(ret != EXIT_FAILURE && 0 != (entry = readdir(d))) {
-                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
-                char *subpath = (char*)malloc(sizeof(char) * (strlen(entry->d_name) + strlen(s) + 2));
-                snprintf(subpath, sizeof(char)*(strlen(entry->d_name) + strlen(s) + 2), "%s%c%s", s, nt_separator(), entry->d_name);
-                if(lstat(subpath, &sf) < 0) {
-                    ret = EXIT_FAILURE;
-                }
-                else {
-                    if(!S_ISDIR(sf.st_mode)) {
-                        ++ work_index;
-                        if(0 != cb(subpath, parentindex, &sf)) {
-                            ret = EXIT_FAILURE;
-                        }
-                    }
-                }
-                free(subpath);
+            if(!name) {
+                snprintf(tmp, sizeof(tmp), "%u", id);
+                name = tmp;
+            }
+            if(0 != (e->name = strdup(name))) {
+                e->id = id;
+                ++ cache->used;
             }
         }
-        closedir(d);
+        ret = e->name;
+    }
+    pthread_mutex_unlock(&nt_name_lock);
+    if(!ret) {
+        // Out of memory: the id itself is still right, but has to outlive this call
+        static __thread char number[16];
+        snprintf(number, sizeof(number), "%u", id);
+        ret = number;
     }
-
     return ret;
+}
+
+const char *nt_user_name(uid_t uid) {
+    return nt_cached_name(&nt_user_cache, uid, 0);
+}
+
+const char *nt_group_name(gid_t gid) {
+    return nt_cached_name(&nt_group_cache, gid, 1);
+}
+
+int nt_cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : (int)count;
+}
+
+typedef struct {
+    int count;
+    volatile int next;
+    void (*fn)(int, void*);
+    void *ctx;
+} nt_parallel_job;
+
+static void *nt_parallel_worker(void *arg) {
+    nt_parallel_job *job = (nt_parallel_job*)arg;
+    int i;
+    while((i = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+        unsigned long long span = NT_TRACE_BEGIN();
+        job->fn(i, job->ctx);
+        NT_TRACE_END("task", 0, span);
+    }
+    return 0;
+}
+
+/*
+ * Calls fn(0..count-1, ctx) from up to nthreads threads, the caller being one of them.
+ * Items are handed out one at a time so a single slow item (hung FUSE mount, huge file...)
+ * does not hold back the others. Returns once every item has been processed.
+ */
+int nt_parallel_for(int count, int nthreads, void (*fn)(int, void*), void *ctx) {
+    nt_parallel_job job;
+    job.count = count;
+    job.next = 0;
+    job.fn = fn;
+    job.ctx = ctx;
+
+    if(nthreads > count) {
+        nthreads = count;
+    }
+    if(nthreads > NT_MAX_THREADS) {
+        nthreads = NT_MAX_THREADS;
+    }
+
+    pthread_t threads[NT_MAX_THREADS];
+    int started = 0;
+    while(started < nthreads - 1) {
+        if(0 != pthread_create(&threads[started], 0, nt_parallel_worker, &job)) {
+            // Not fatal: whatever threads we have, including ours, will pick up the slack.
+            break;
+        }
+        ++ started;
+    }
+    nt_parallel_worker(&job);
+    for(int i=0; i<started; i++) {
+        pthread_join(threads[i], 0);
+    }
+
+    return EXIT_SUCCESS;
 }
\ No newline at end of file
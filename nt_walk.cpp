@@ -0,0 +1,473 @@
+// (c) Chris F. Ravenscroft, VoilaWeb. For licensing information, check attached LICENSE file.
+
+#include "nativetools.hpp"
+
+/*
+ * Iterative directory walker.
+ *
+ * The stack of directories being read lives on the heap, so tree depth only
+ * costs one small frame per level. Each frame keeps its directory open, and
+ * everything below it is reached relative to that descriptor with openat(),
+ * fstatat() and the like, so the depth of a tree is never bounded by
+ * PATH_MAX. Visitors get the descriptor as well, and should do the same.
+ *
+ * When more than work_fd_budget directories would be open, the one opened
+ * first (the shallowest) is closed. Whatever was left to read from it in the
+ * current pass is read beforehand, so it never has to be positioned again:
+ * telldir() cookies do not survive the directory being reopened on every
+ * filesystem, and bionic only has them from API 23. It is reopened from the
+ * directory below it through "..", checked to still be the same one, or
+ * from the closest open ancestor otherwise.
+ *
+ * Full paths, for the visitors to report, are kept in a single buffer that
+ * grows with the depth of the current entry: each frame only remembers how
+ * long its own path is.
+ *
+ * Batches and whatever visitors need per entry come from one arena per
+ * walk. Each frame releases what it allocated when it is popped, each
+ * batch when the next one is read, and each entry once visited (unless it is
+ * descended into), so memory follows the depth of the tree rather than the
+ * number of entries in it.
+ *
+ * Once a batch has been read, all of its entries are fstatat()'ed in one go.
+ * With --order=inode or --order=name, those calls are issued by increasing
+ * inode number: on ext4 readdir() returns entries in hash order, which makes
+ * the stat calls jump all over the inode table, one of the costliest things
+ * a cold crawl does on SD cards and USB disks. There is no userspace way to
+ * read ahead the inode table itself; walking it in order is the next best
+ * thing, as consecutive inodes then share table blocks. --order=inode also
+ * hands entries to the visitor in that order, while --order=name reads each
+ * directory in full and hands them over sorted by name.
+ *
+ * Each directory is read ops->passes times. Every entry is handed to
+ * ops->visit() with the current pass number; returning NT_WALK_DESCEND makes
+ * the walker go into that directory right away and call ops->leave() on it
+ * once it has been read entirely.
+ */
+
+#define NT_WALK_BATCH 64
+// Sorting pays off with bigger batches
+#define NT_WALK_SORT_BATCH 1024
+
+typedef struct {
+    char *name;
+    ino_t ino;
+    unsigned char type;
+    int err;                // errno from fstatat(), 0 if sf is valid
+    struct stat sf;
+} nt_walk_rec;
+
+typedef struct {
+    nt_walk_entry self;     // How our parent saw this directory, for leave()
+    size_t len;             // Length of our path in the walker's buffer
+    size_t name_at;         // Where our name starts in it
+    DIR *d;
+    int pass;
+    int eof;
+    nt_walk_rec *rest;      // What was left to read when d had to be closed mid-pass,
+    char *rest_names;       // names as offsets
+    int rest_count;
+    size_t rest_len;
+    nt_walk_rec *recs;
+    int count;
+    int next;
+    nt_arena_mark base;     // Before self.aux was allocated
+    nt_arena_mark batch;    // Before recs were allocated
+} nt_walk_frame;
+
+typedef struct {
+    nt_walk_frame *frames;
+    int depth;
+    int size;
+    unsigned int open;
+    nt_walk_ops *ops;
+    nt_arena arena;
+    // Path of the entry being visited, or of the directory being read
+    char *path;
+    size_t path_size;
+    // readdir() goes here first, as the size of a batch is not known in advance
+    nt_walk_rec *scratch;
+    int scratch_size;
+    char *names;
+    size_t names_size;
+} nt_walker;
+
+static void nt_walk_reserve(nt_walker *w, size_t size) {
+    if(size > w->path_size) {
+        w->path_size = size * 2;
+        w->path = (char*)realloc(w->path, w->path_size);
+    }
+}
+
+// Path of a frame's directory, until the next entry is visited
+static char *nt_walk_dir(nt_walker *w, nt_walk_frame *f) {
+    w->path[f->len] = '\0';
+    return w->path;
+}
+
+static void nt_walk_push(nt_walker *w, nt_walk_entry *e, size_t len, size_t name_at, nt_arena_mark base) {
+    if(w->depth == w->size) {
+        w->size = w->size ? w->size * 2 : 16;
+        w->frames = (nt_walk_frame*)realloc(w->frames, sizeof(nt_walk_frame) * w->size);
+    }
+    nt_walk_frame *f = &w->frames[w->depth++];
+    memset(f, 0, sizeof(nt_walk_frame));
+    f->self    = *e;
+    f->len     = len;
+    f->name_at = name_at;
+    f->base    = base;
+    f->batch   = nt_arena_save(&w->arena);
+}
+
+static void nt_walk_close(nt_walker *w, nt_walk_frame *f) {
+    if(f->d) {
+        closedir(f->d);
+        f->d = 0;
+        -- w->open;
+    }
+}
+
+static void nt_walk_pop(nt_walker *w) {
+    nt_walk_frame *f = &w->frames[--w->depth];
+    nt_walk_close(w, f);
+    free(f->rest);
+    free(f->rest_names);
+    nt_arena_release(&w->arena, f->base);
+}
+
+// Reads up to limit entries (0: all of them) into scratch, with names as offsets into names
+static int nt_walk_read(nt_walker *w, nt_walk_frame *f, int limit, size_t *names_len) {
+    int count = 0;
+    *names_len = 0;
+    struct dirent *entry;
+    while(!limit || count < limit) {
+        if(0 == (entry = NT_IO(NT_OP_READDIR, readdir(f->d)))) {
+            f->eof = 1;
+            break;
+        }
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        size_t len = strlen(entry->d_name) + 1;
+        if(*names_len + len > w->names_size) {
+            w->names_size = (*names_len + len) * 2;
+            w->names = (char*)realloc(w->names, w->names_size);
+        }
+        if(count == w->scratch_size) {
+            w->scratch_size = w->scratch_size ? w->scratch_size * 2 : NT_WALK_BATCH;
+            w->scratch = (nt_walk_rec*)realloc(w->scratch, sizeof(nt_walk_rec) * w->scratch_size);
+        }
+        nt_walk_rec *rec = &w->scratch[count++];
+        // Offset for now, names may still move
+        rec->name = (char*)*names_len;
+        rec->ino  = entry->d_ino;
+        rec->type = entry->d_type;
+        memcpy(w->names + *names_len, entry->d_name, len);
+        *names_len += len;
+    }
+    return count;
+}
+
+// Make room by closing the oldest directory open, other than frame i's
+static int nt_walk_evict(nt_walker *w, int i) {
+    for(int j=0; j<w->depth; j++) {
+        nt_walk_frame *f = &w->frames[j];
+        if(f->d && j != i) {
+            if(!f->eof) {
+                size_t len;
+                int count = nt_walk_read(w, f, 0, &len);
+                if(count) {
+                    f->rest       = (nt_walk_rec*)malloc(sizeof(nt_walk_rec) * count);
+                    f->rest_names = (char*)malloc(len);
+                    memcpy(f->rest, w->scratch, sizeof(nt_walk_rec) * count);
+                    memcpy(f->rest_names, w->names, len);
+                    f->rest_count = count;
+                    f->rest_len   = len;
+                }
+            }
+            nt_walk_close(w, f);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// openat() and fdopendir() together, so that NT_OP_OPENDIR times the whole of it
+static DIR *nt_walk_opendir(int at, const char *name, int flags) {
+    int fd = openat(at, name, flags);
+    DIR *d = fd < 0 ? 0 : fdopendir(fd);
+    if(fd >= 0 && !d) {
+        close(fd);
+    }
+    return d;
+}
+
+// Opens frame i's directory from its parent's, reopening the closest ancestors first if need be
+static int nt_walk_open(nt_walker *w, int i) {
+    unsigned int budget = work_fd_budget > 0 ? work_fd_budget : 1;
+    int j = i;
+    while(j > 0 && !w->frames[j - 1].d) {
+        -- j;
+    }
+    for(; j <= i; j++) {
+        nt_walk_frame *f = &w->frames[j];
+        // Our path may be followed by a deeper one that is still needed
+        char c = w->path[f->len];
+        w->path[f->len] = '\0';
+        f->d = j ? NT_IO(NT_OP_OPENDIR, nt_walk_opendir(dirfd(w->frames[j - 1].d), w->path + f->name_at, O_RDONLY | O_DIRECTORY | O_NOFOLLOW))
+                 : NT_IO(NT_OP_OPENDIR, nt_walk_opendir(AT_FDCWD, w->path, O_RDONLY | O_DIRECTORY));
+        w->path[f->len] = c;
+        if(!f->d) {
+            return EXIT_FAILURE;
+        }
+        ++ w->open;
+        if(!j) {
+            // For our children to check ".." against
+            fstat(dirfd(f->d), &f->self.sf);
+        }
+        // Our parent was only needed for openat()
+        while(w->open > budget && nt_walk_evict(w, j)) {
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Back from the directory on top: its parent is reopened through "..", if it is still the same one
+static int nt_walk_up(nt_walker *w) {
+    nt_walk_frame *f = &w->frames[w->depth - 1];
+    nt_walk_frame *parent = f - 1;
+    if(parent->d) {
+        return EXIT_SUCCESS;
+    }
+    if(f->d) {
+        struct stat sf;
+        DIR *d = NT_IO(NT_OP_OPENDIR, nt_walk_opendir(dirfd(f->d), "..", O_RDONLY | O_DIRECTORY));
+        if(d && 0 == fstat(dirfd(d), &sf) &&
+           sf.st_dev == parent->self.sf.st_dev && sf.st_ino == parent->self.sf.st_ino) {
+            parent->d = d;
+            // One over the budget, until f is closed
+            ++ w->open;
+            return EXIT_SUCCESS;
+        }
+        if(d) {
+            closedir(d);
+        }
+    }
+    return nt_walk_open(w, w->depth - 2);
+}
+
+static int nt_walk_by_inode(const void *a, const void *b) {
+    ino_t ia = ((nt_walk_rec*)a)->ino, ib = ((nt_walk_rec*)b)->ino;
+    return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+static int nt_walk_by_name(const void *a, const void *b) {
+    return strcmp(((nt_walk_rec*)a)->name, ((nt_walk_rec*)b)->name);
+}
+
+static int nt_walk_fill(nt_walker *w) {
+    nt_walk_frame *f = &w->frames[w->depth - 1];
+    if(!f->d && EXIT_SUCCESS != nt_walk_open(w, w->depth - 1)) {
+        return EXIT_FAILURE;
+    }
+    nt_arena_release(&w->arena, f->batch);
+    f->count = 0;
+    f->next = 0;
+    nt_walk_rec *src;
+    char *src_names;
+    size_t names_len;
+
+    // 0: the whole directory at once
+    int limit = work_order == NT_ORDER_NAME  ? 0 :
+                work_order == NT_ORDER_INODE ? NT_WALK_SORT_BATCH : NT_WALK_BATCH;
+
+    unsigned long long span = NT_TRACE_BEGIN();
+    if(f->rest) {
+        f->count  = f->rest_count;
+        names_len = f->rest_len;
+        src       = f->rest;
+        src_names = f->rest_names;
+    }
+    else {
+        f->count  = nt_walk_read(w, f, limit, &names_len);
+        src       = w->scratch;
+        src_names = w->names;
+    }
+    NT_TRACE_END("readdir", nt_walk_dir(w, f), span);
+
+    f->recs = (nt_walk_rec*)nt_arena_alloc(&w->arena, sizeof(nt_walk_rec) * f->count);
+    char *names = (char*)nt_arena_alloc(&w->arena, names_len);
+    if(!f->recs || !names) {
+        f->count = 0;
+        return EXIT_FAILURE;
+    }
+    memcpy(names, src_names, names_len);
+    for(int i=0; i<f->count; i++) {
+        f->recs[i] = src[i];
+        f->recs[i].name = names + (size_t)src[i].name;
+    }
+    free(f->rest);
+    free(f->rest_names);
+    f->rest = 0;
+    f->rest_names = 0;
+    if(work_order != NT_ORDER_DISK) {
+        qsort(f->recs, f->count, sizeof(nt_walk_rec), nt_walk_by_inode);
+    }
+
+    span = NT_TRACE_BEGIN();
+    int fd = dirfd(f->d);
+    for(int i=0; i<f->count; i++) {
+        nt_walk_rec *rec = &f->recs[i];
+        nt_qos_ops(1);
+        // Be sure to never follow links or we may end up in hairy situations
+        rec->err = NT_IO(NT_OP_LSTAT, fstatat(fd, rec->name, &rec->sf, AT_SYMLINK_NOFOLLOW)) < 0 ? errno : 0;
+    }
+    NT_TRACE_END("stat", nt_walk_dir(w, f), span);
+
+    if(work_order == NT_ORDER_NAME) {
+        qsort(f->recs, f->count, sizeof(nt_walk_rec), nt_walk_by_name);
+    }
+    return EXIT_SUCCESS;
+}
+
+int nt_walk(char* s, char* aux, long tag, nt_walk_ops* ops) {
+    int ret = EXIT_SUCCESS;
+
+    nt_walker w;
+    memset(&w, 0, sizeof(w));
+    w.ops = ops;
+
+    size_t len = strlen(s);
+    nt_walk_reserve(&w, len + 1);
+    memcpy(w.path, s, len + 1);
+
+    nt_arena_mark base = nt_arena_save(&w.arena);
+    nt_walk_entry root;
+    memset(&root, 0, sizeof(root));
+    root.path  = w.path;
+    root.name  = nt_basename(w.path);
+    root.dirfd = AT_FDCWD;
+    if(aux) {
+        root.aux = (char*)nt_arena_alloc(&w.arena, strlen(aux) + 1);
+        if(!root.aux) {
+            free(w.path);
+            nt_arena_free(&w.arena);
+            return EXIT_FAILURE;
+        }
+        strcpy(root.aux, aux);
+    }
+    root.tag   = tag;
+    root.arena = &w.arena;
+    nt_walk_push(&w, &root, len, root.name - w.path, base);
+
+    while(w.depth > 0) {
+        nt_walk_frame *f = &w.frames[w.depth - 1];
+
+        if(f->next == f->count) {
+#if !defined(NT_NO_TRACE)
+            // While tracing, output is flushed after each batch so that stalls show up
+            if(work_trace && f->count) {
+                nt_trace_flush(stdout);
+            }
+#endif
+            if(!f->eof || f->rest) {
+                if(EXIT_SUCCESS != nt_walk_fill(&w)) {
+                    ret = EXIT_FAILURE;
+                    if(!ops->keep_going || w.depth == 1) {
+                        break;
+                    }
+                    nt_walk_pop(&w);
+                }
+            }
+            else if(++ f->pass < ops->passes) {
+                f->eof = 0;
+                f->count = 0;
+                f->next = 0;
+                if(f->d) {
+                    rewinddir(f->d);
+                }
+            }
+            else {
+                // The root is the caller's business
+                if(w.depth > 1) {
+                    int up = nt_walk_up(&w);
+                    if(ops->leave) {
+                        if(up == EXIT_SUCCESS) {
+                            f->self.path  = nt_walk_dir(&w, f);
+                            f->self.name  = w.path + f->name_at;
+                            f->self.dirfd = dirfd(w.frames[w.depth - 2].d);
+                            up = ops->leave(&f->self, ops->ctx);
+                        }
+                        if(up != EXIT_SUCCESS) {
+                            ret = EXIT_FAILURE;
+                            if(!ops->keep_going) {
+                                break;
+                            }
+                        }
+                    }
+                }
+                nt_walk_pop(&w);
+            }
+            continue;
+        }
+
+        // Entries are handed over along with their directory's descriptor
+        if(!f->d && EXIT_SUCCESS != nt_walk_open(&w, w.depth - 1)) {
+            ret = EXIT_FAILURE;
+            if(!ops->keep_going || w.depth == 1) {
+                break;
+            }
+            nt_walk_pop(&w);
+            continue;
+        }
+
+        nt_walk_rec *rec = &f->recs[f->next++];
+        nt_arena_mark mark = nt_arena_save(&w.arena);
+        size_t namelen = strlen(rec->name);
+        nt_walk_reserve(&w, f->len + namelen + 2);
+        w.path[f->len] = nt_separator();
+        memcpy(w.path + f->len + 1, rec->name, namelen + 1);
+
+        nt_walk_entry e;
+        e.path       = w.path;
+        e.name       = w.path + f->len + 1;
+        e.dirfd      = dirfd(f->d);
+        e.depth      = f->self.depth + 1;
+        e.parent_aux = f->self.aux;
+        e.parent_tag = f->self.tag;
+        e.aux        = 0;
+        e.tag        = 0;
+        e.arena      = &w.arena;
+
+        int action;
+        if(rec->err) {
+            action = NT_WALK_FAIL;
+        }
+        else {
+            e.sf   = rec->sf;
+            action = ops->visit(&e, f->pass, ops->ctx);
+        }
+
+        if(action == NT_WALK_DESCEND) {
+            // Careful: f is not valid anymore past this point
+            nt_walk_push(&w, &e, f->len + 1 + namelen, f->len + 1, mark);
+            continue;
+        }
+        nt_arena_release(&w.arena, mark);
+        if(action == NT_WALK_FAIL) {
+            ret = EXIT_FAILURE;
+            if(!ops->keep_going) {
+                break;
+            }
+        }
+    }
+
+    while(w.depth > 0) {
+        nt_walk_pop(&w);
+    }
+    free(w.frames);
+    free(w.path);
+    free(w.scratch);
+    free(w.names);
+    nt_arena_free(&w.arena);
+
+    return ret;
+}
\ No newline at end of file